@@ -213,9 +213,10 @@ class Actors( Renderable ):
 
 
 
-    def merged_bvhs(self):
+    def merged_bvhs(self, instance_masks = None):
         '''
             Warning, this will update actors
+            instance_masks: optional, a uint32 mask for each visible actor (see BVH.merge_bvhs())
         '''
         bvhs = []
         matrices = []
@@ -223,11 +224,14 @@ class Actors( Renderable ):
 
         
         id_to_actors = self.get_visible_actors()
-        for i, (a, parentTransform) in enumerate(id_to_actors):
+        for a, _ in id_to_actors:
             a.geometry.update()
+        actor_bvhs = Geometry.goc_bvhs([a.geometry for a, _ in id_to_actors])
+
+        for i, (a, parentTransform) in enumerate(id_to_actors):
             if a.transform:
                 a.transform.update()
-            bvh = a.geometry.goc_bvh(True)
+            bvh = actor_bvhs[i]
             bvhs.append(bvh if bvh is None else bvh.bvh)
             p = tf_to_numpy(a.transform) if parentTransform else np.eye(4, dtype = 'f4')
             m = tf_to_numpy(a.transform) if a.transform else np.eye(4, dtype = 'f4')
@@ -251,7 +255,7 @@ class Actors( Renderable ):
             , "textures": textures
             , "attribs": attributes})
 
-        bvh, triangles_mapping, triangle_offsets, vertex_offsets = BVH.merge_bvhs(bvhs, matrices)
+        bvh, triangles_mapping, triangle_offsets, vertex_offsets = BVH.merge_bvhs(bvhs, matrices, instance_masks)
 
         return bvh, {'id_to_actors': id_to_actors
         , 'triangles_mapping': triangles_mapping
@@ -48,9 +48,25 @@ def colored_point_cloud(points, colors, matrix = np.eye(4, dtype = 'f4'), name =
         , name = name
     )
 
-def colored_quad_cloud(points, amplitude ,indices, colormap = "viridis", log_scale = False, cm_resolution = 256, matrix = np.eye(4, dtype = 'f4'), color=None,name = "quad"):
+def colored_quad_cloud(points, amplitude ,indices, colormap = "viridis", log_scale = False, cm_resolution = 256, matrix = np.eye(4, dtype = 'f4'), color=None,name = "quad", cpu = False, range_decay = None):
     #color = ensure_QColor(color)
 
+    if cpu and color is None: # see colormap_point_cloud()
+        colormap_ = getattr(cm, colormap)(mpl_colors.Normalize(0, cm_resolution)(np.arange(cm_resolution)))
+        return Actors.Actor(
+            geometry = Geometry.Geometry(
+                indices = Array.ArrayBase(ndarray = indices)
+                ,attribs = CustomAttribs.ColormapAttribs(
+                    vertices = Array.ArrayBase(ndarray = points)
+                    , amplitude = Array.ArrayBase(ndarray = amplitude)
+                    , color_map = Array.ArrayBase(ndarray = np.ascontiguousarray(colormap_ * 255, dtype=np.uint8))
+                    , log_scale = log_scale, range_decay = range_decay)
+                , primitive_type = Geometry.PrimitiveType.TRIANGLES
+            ), effect = CustomEffects.point_colors()
+            , transform = ensure_Transform(matrix)
+            , name = name
+        )
+
     min_amplitude = float(amplitude.min())
     max_amplitude = float(amplitude.max())
 
@@ -79,11 +95,31 @@ def colored_quad_cloud(points, amplitude ,indices, colormap = "viridis", log_sca
         , name = name
     )
                 
-def colormap_point_cloud(points, amplitude, min_amplitude = None, max_amplitude = None, colormap = "viridis", log_scale = False, cm_resolution = 256, matrix = np.eye(4, dtype = 'f4'), name = "cmap_pcl"):
+def colormap_point_cloud(points, amplitude, min_amplitude = None, max_amplitude = None, colormap = "viridis", log_scale = False, cm_resolution = 256, matrix = np.eye(4, dtype = 'f4'), name = "cmap_pcl", cpu = False, range_decay = None):
     """
     resolution: the color map texture resolution, it affect granularity/precision of the color distribution only
+    cpu: map amplitudes to RGBA8 colors on the CPU (see CustomAttribs.ColormapAttribs) rather than in the shader,
+    with the same colors ('log_scale' included), except for amplitudes in the log scale's first entry, which get the colormap's
+    first color rather than matplotlib's "bad" color. Their range is re-evaluated on each update
+    (tracked across updates if 'range_decay' is set), unless min_amplitude/max_amplitude are set
     """
 
+    if cpu:
+        colormap_ = getattr(cm, colormap)(mpl_colors.Normalize(0, cm_resolution)(np.arange(cm_resolution)))
+        return Actors.Actor(
+            geometry = Geometry.Geometry(
+                attribs = CustomAttribs.ColormapAttribs(
+                    vertices = Array.ArrayBase(ndarray = points)
+                    , amplitude = Array.ArrayBase(ndarray = amplitude)
+                    , color_map = Array.ArrayBase(ndarray = np.ascontiguousarray(colormap_ * 255, dtype=np.uint8))
+                    , min_amplitude = min_amplitude, max_amplitude = max_amplitude
+                    , log_scale = log_scale, range_decay = range_decay)
+                , primitive_type = Geometry.PrimitiveType.POINTS
+            ), effect = CustomEffects.point_colors()
+            , transform = ensure_Transform(matrix)
+            , name = name
+        )
+
     if min_amplitude is None:
         min_amplitude = float(amplitude.min())
 
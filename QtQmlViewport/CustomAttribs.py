@@ -1,6 +1,9 @@
 from QtQmlViewport import Product
 from QtQmlViewport.Array import ArrayBase
 from QtQmlViewport.Geometry import Attribs
+from QtQmlViewport.PyBVH import colormap
+
+import numpy as np
 
 class AmplitudeAttribs(Attribs):
     def __init__( self, parent=None, vertices = None, normals = None, amplitude = None ):
@@ -33,6 +36,78 @@ class ColorsAttribs(Attribs):
         a["colors"] = self._colors
         return a
 
+class ColormapAttribs(Attribs):
+    '''
+        maps 'amplitude' through 'colorMap' (a (resolution, 4) uint8 lookup table) on the CPU (see src/colormap.h),
+        into an RGBA8 'colors' attribute, e.g. for CustomEffects.point_colors(). With logScale, colors match
+        CustomEffects.color_map() with a LogNorm lookup table (see CustomActors.colormap_point_cloud()).
+        minAmplitude and maxAmplitude default to the amplitudes' range, tracked across frames
+        if rangeDecay is set (0: the range only grows, 1: the range is the last frame's range)
+    '''
+    def __init__( self, parent=None, vertices = None, normals = None, amplitude = None, color_map = None
+    , min_amplitude = None, max_amplitude = None, log_scale = False, range_decay = None ):
+        super(ColormapAttribs, self).__init__( parent, vertices, normals )
+        self.amplitude = amplitude
+        self.colorMap = color_map
+        self.minAmplitude = min_amplitude
+        self.maxAmplitude = max_amplitude
+        self.logScale = log_scale
+        self.rangeDecay = range_decay
+        self._colors = ArrayBase(ndarray = np.empty((0, 4), np.uint8)) # not an input: refreshing it must not dirty us
+        self._running_range = None
+
+    Product.InputProperty(vars(), ArrayBase, 'amplitude', None)
+
+    Product.InputProperty(vars(), ArrayBase, 'colorMap', None)
+
+    Product.InputProperty(vars(), 'QVariant', 'minAmplitude', None)
+
+    Product.InputProperty(vars(), 'QVariant', 'maxAmplitude', None)
+
+    Product.InputProperty(vars(), bool, 'logScale', False)
+
+    Product.InputProperty(vars(), 'QVariant', 'rangeDecay', None)
+
+    def amplitude_range(self, amplitude):
+        if self._minAmplitude is not None and self._maxAmplitude is not None:
+            return self._minAmplitude, self._maxAmplitude
+
+        if self._rangeDecay is None:
+            self._running_range = None
+            min_amplitude, max_amplitude = colormap.min_max(amplitude)
+        else:
+            if self._running_range is None:
+                self._running_range = colormap.RunningRange(self._rangeDecay)
+            self._running_range.decay = self._rangeDecay
+            min_amplitude, max_amplitude = self._running_range.update(amplitude)
+
+        return (min_amplitude if self._minAmplitude is None else self._minAmplitude
+            , max_amplitude if self._maxAmplitude is None else self._maxAmplitude)
+
+    def _update(self):
+        if self._amplitude is None or self._colorMap is None:
+            raise RuntimeError('amplitude or colorMap is None')
+
+        amplitude = self._amplitude.ndarray.reshape(-1)
+        if self._colors.ndarray.shape[0] != amplitude.shape[0]:
+            self._colors.ndarray = np.empty((amplitude.shape[0], 4), np.uint8)
+
+        min_amplitude, max_amplitude = self.amplitude_range(amplitude)
+        colormap.apply(amplitude, self._colorMap.ndarray, self._colors.ndarray, min_amplitude, max_amplitude, self._logScale)
+
+        # colors were written in place, notify the renderer
+        self._colors.makeDirty()
+        self._colors.makeClean()
+
+    def get_attributes(self):
+        '''
+        override this method to add all your attribs
+        (colors are mapped by update(), once per change of an input)
+        '''
+        a = super(ColormapAttribs, self).get_attributes()
+        a["colors"] = self._colors
+        return a
+
 class SegmentationLabelsAttribs(Attribs):
     def __init__( self, parent=None ):
         super(SegmentationLabelsAttribs, self).__init__( parent )
@@ -1,12 +1,16 @@
 from . import BVH as PybindBVH
 from . import PointsBVH as PybindPointsBVH
-from QtQmlViewport import Product, utils
+from . import BuildMethod as PybindBuildMethod
+from . import BVHHandle as PybindBVHHandle
+from . import PointsBVHHandle as PybindPointsBVHHandle
+from QtQmlViewport import Product, Profiling, utils
 from QtQmlViewport.Array import ArrayBase
 
 from OpenGL import GL as gl
 from PyQt5.QtCore import QObject, Q_ENUMS, pyqtSlot as Slot
 from PyQt5.QtGui import QVector3D
 import numpy as np
+import traceback
 
 class Attribs( Product.Product ):
     def __init__( self, parent=None, vertices = None, normals = None ):
@@ -37,28 +41,71 @@ class PrimitiveType(QObject): #for Q_ENUMS: derive from QObject
     TRIANGLE_STRIP = gl.GL_TRIANGLE_STRIP
     TRIANGLE_FAN = gl.GL_TRIANGLE_FAN
 
+class BuildMethod(QObject): #for Q_ENUMS: derive from QObject
+    KD = int(PybindBuildMethod.KD) # serial, median split
+    LBVH = int(PybindBuildMethod.LBVH) # parallel, fastest build, meant for per-frame (streaming) geometry
+    LBVH_TREELETS = int(PybindBuildMethod.LBVH_TREELETS) # parallel, slower build, faster queries
+    SBVH = int(PybindBuildMethod.SBVH) # spatial splits, slowest build, fastest queries on long, thin or overlapping triangles (e.g. lanes, grids), meant for static meshes
+
 class BVH( Product.Product ):
 
-    def __init__( self, parent=None, indices=None, points=None, primitive_type = PrimitiveType.TRIANGLES):
+    def __init__( self, parent=None, indices=None, points=None, primitive_type = PrimitiveType.TRIANGLES, build_method = BuildMethod.KD, masks = None, background = False, max_duplication = 2.0):
         super(BVH, self).__init__( parent )
 
         self.indices = indices
         self.points = points
         self.primitiveType = primitive_type
+        self.buildMethod = build_method
+        self.maxDuplication = max_duplication
+        self.masks = masks
+        self.background = background
         self.bvh = None
         self._shape_indices = None
+        self._handle = None
+        self._handle_topology = None
+        self._handle_build = None
 
     PrimitiveType = PrimitiveType
 
+    BuildMethod = BuildMethod
+
     Q_ENUMS(PrimitiveType)
 
+    Q_ENUMS(BuildMethod)
+
     Product.InputProperty(vars(), int, 'primitiveType', PrimitiveType.TRIANGLES)
 
+    Product.InputProperty(vars(), int, 'buildMethod', BuildMethod.KD)
+
+    Product.InputProperty(vars(), float, 'maxDuplication', 2.0) # SBVH only: references may grow up to (1 + maxDuplication) times the primitives, lower builds faster
+
     Product.InputProperty(vars(), ArrayBase, 'indices', None)
 
     Product.InputProperty(vars(), ArrayBase, 'points', None)
 
-    def _update(self):
+    Product.InputProperty(vars(), ArrayBase, 'masks', None) # uint32, one per primitive, queries' include_mask/exclude_mask are tested against it (PyBVH.DEFAULT_MASK if None)
+
+    Product.InputProperty(vars(), bool, 'background', False) # build (or refit, when only points changed) in a background thread
+
+    @property
+    def bvh(self):
+        '''
+            the pybind BVH, in background mode: the latest completed one (None until the first build completes),
+            queries keep the snapshot they got alive, even if a newer BVH is published meanwhile
+            snapshots are frozen (shared with background threads), set_masks() and set_instances() raise on them
+        '''
+        if self._handle is not None:
+            return self._handle.snapshot()
+        return self._bvh
+
+    @bvh.setter
+    def bvh(self, bvh):
+        self._bvh = bvh
+
+    def _prepare(self):
+        '''
+            returns the pybind BVH class and its constructor's (indices, vertices)
+        '''
         if self._indices is None or self._points is None:
             raise RuntimeError('indices or points is None')
 
@@ -66,42 +113,156 @@ class BVH( Product.Product ):
         assert self._points.ndarray.dtype.type in [np.float32, np.float64], "not float32/64"
         assert self._indices.ndarray.dtype.type == np.uint32, 'BVH indices must be of type uint32'
 
-
         if self._primitiveType == PrimitiveType.TRIANGLES:
             self._shape_indices = self._indices.ndarray.reshape(self._indices.ndarray.shape[0]//3, 3, order = 'C')
-            self.bvh = PybindBVH(self._shape_indices, self._points.ndarray.astype('f4'))
+            return PybindBVH, (self._shape_indices, self._points.ndarray.astype('f4'))
         elif self._primitiveType == PrimitiveType.POINTS:
             self._shape_indices = self._indices.ndarray.reshape(self._indices.ndarray.shape[0], 1, order = 'C')
-            self.bvh = PybindPointsBVH(self._shape_indices, self._points.ndarray.astype('f4'))
+            return PybindPointsBVH, (self._shape_indices, self._points.ndarray.astype('f4'))
         elif self._primitiveType == PrimitiveType.LINES:
             
             indices = ArrayBase(ndarray = np.array([0,1,2, 1,2,3, 0,4,2, 2,4,6, 1,5,3, 3,5,7, 4,5,6, 5,6,7, 2,3,6, 3,6,7], 'u4'))
             self._shape_indices = indices.ndarray.reshape(indices.ndarray.shape[0]//3, 3, order = 'C')
-            self.bvh = PybindBVH(self._shape_indices, self._points.ndarray.astype('f4'))
+            return PybindBVH, (self._shape_indices, self._points.ndarray.astype('f4'))
         else:
             raise NotImplementedError()
 
+    def _finish(self, bvh):
+        self.bvh = bvh
+        # masks are per primitive, they don't apply to a LINES box's triangles
+        if self._masks is not None and self._primitiveType != PrimitiveType.LINES:
+            self.bvh.set_masks(self._masks.ndarray.astype('u4'))
+
+    @Profiling.profiled('BVH.update')
+    def _update(self):
+        pybind_class, args = self._prepare()
+        if self._background:
+            self._submit(pybind_class, args)
+        else:
+            self._handle = None
+            self._handle_build = None
+            self._finish(pybind_class(*args, PybindBuildMethod(self._buildMethod), self._maxDuplication))
+
+    def _submit(self, pybind_class, args):
+        '''
+            submits a background build, or a refit if the topology (indices, masks, build method and max duplication) is the published BVH's one.
+            An error of a previous request is raised once this request is submitted
+        '''
+        handle_class = PybindBVHHandle if pybind_class is PybindBVH else PybindPointsBVHHandle
+        indices, vertices = args
+        masks = self._masks.ndarray.astype('u4') if self._masks is not None and self._primitiveType != PrimitiveType.LINES else np.empty((0), 'u4')
+
+        if not isinstance(self._handle, handle_class):
+            self._handle = handle_class()
+            self._handle_topology = None
+            self._handle_build = None
+
+        self._track_build()
+
+        t = self._handle_topology
+        if self._handle_build is None and t is not None and t[0] == (self._buildMethod, self._maxDuplication) and np.array_equal(t[1], indices) and np.array_equal(t[2], masks):
+            self._handle.refit(vertices)
+        else:
+            version = self._handle.build(indices, vertices, PybindBuildMethod(self._buildMethod), masks, self._maxDuplication)
+            self._handle_build = (version, ((self._buildMethod, self._maxDuplication), indices.copy(), masks))
+
+        self._handle.rethrow()
+
+    def _track_build(self):
+        '''
+            the build in flight's topology becomes the one refits apply to once it is published, it is forgotten if it failed
+        '''
+        if self._handle_build is not None:
+            version, topology = self._handle_build
+            pending = self._handle.pending # read first: once idle, the version is final
+            if self._handle.version >= version:
+                self._handle_topology, self._handle_build = topology, None
+            elif not pending:
+                self._handle_build = None
+
+    @staticmethod
+    @Profiling.profiled('BVH.update_many')
+    def update_many(bvhs):
+        '''
+            updates the dirty BVHs among 'bvhs' (None entries are ignored) with one parallel
+            build_many() call per pybind BVH class and build method, the GIL being released.
+            BVHs in background mode are submitted to their own handle instead.
+            As with Product.update(), a BVH's error is stored in its _error, other BVHs are still updated
+        '''
+        dirty = [b for b in bvhs if b is not None and b.dirty and not b._background]
+
+        for b in bvhs: # background BVHs don't block
+            if b is not None and b.dirty and b._background:
+                b.update()
+
+        batches = {}
+        for b in dirty:
+            b._error = None
+            try:
+                for d in b._dependencies:
+                    if not d.update():
+                        raise RuntimeError(d._error)
+                pybind_class, args = b._prepare()
+                batches.setdefault((pybind_class, b._buildMethod, b._maxDuplication), []).append((b, args))
+            except Exception as e:
+                b._error = e
+                print(traceback.format_exc())
+
+        try:
+            for (pybind_class, build_method, max_duplication), batch in batches.items():
+                try:
+                    built = pybind_class.build_many([args for _, args in batch], PybindBuildMethod(build_method), max_duplication)
+                except Exception:
+                    print(traceback.format_exc())
+                    built = [None] * len(batch) # one bad mesh fails the whole batch, build them one by one to contain it
+
+                for (b, args), bvh in zip(batch, built):
+                    try:
+                        b._finish(bvh if bvh is not None else pybind_class(*args, PybindBuildMethod(build_method), max_duplication))
+                    except Exception as e:
+                        b._error = e
+                        print(traceback.format_exc())
+        finally:
+            for b in dirty:
+                b.makeClean()
+
 class Geometry( Product.Product ):
 
 
-    def __init__( self, parent=None, indices = None, attribs = None, primitive_type = PrimitiveType.TRIANGLES ):
+    def __init__( self, parent=None, indices = None, attribs = None, primitive_type = PrimitiveType.TRIANGLES, build_method = BuildMethod.KD, masks = None, background_bvh = False, max_duplication = 2.0 ):
         super(Geometry, self).__init__( parent )
         self.bvh = None
 
         self.indices = indices
         self.attribs = attribs
         self.primitiveType = primitive_type
+        self.buildMethod = build_method
+        self.maxDuplication = max_duplication
+        self.masks = masks
+        self.backgroundBVH = background_bvh
 
     PrimitiveType = PrimitiveType
 
+    BuildMethod = BuildMethod
+
     Q_ENUMS(PrimitiveType)
 
+    Q_ENUMS(BuildMethod)
+
     Product.InputProperty(vars(), int, 'primitiveType', PrimitiveType.TRIANGLES)
 
+    Product.InputProperty(vars(), int, 'buildMethod', BuildMethod.KD)
+
+    Product.InputProperty(vars(), float, 'maxDuplication', 2.0) # see BVH.maxDuplication
+
     Product.InputProperty(vars(), ArrayBase, 'indices', None)
 
     Product.InputProperty(vars(), Attribs, 'attribs', None)
 
+    Product.InputProperty(vars(), ArrayBase, 'masks', None) # see BVH.masks
+
+    Product.InputProperty(vars(), bool, 'backgroundBVH', False) # see BVH.background
+
     @Slot(int, QVector3D, str, result = QVector3D)
     def faceAttribtAt(self, id, tuv, attribute):
         face = self.faceIndices(id)
@@ -124,10 +285,24 @@ class Geometry( Product.Product ):
     def goc_bvh(self, update = False):
 
         if self.bvh is None and self.primitiveType in [PrimitiveType.TRIANGLES, PrimitiveType.POINTS, PrimitiveType.LINES]:
-            self.bvh = BVH(self, self.indices, self.attribs.vertices, self.primitiveType)
+            self.bvh = BVH(self, self.indices, self.attribs.vertices, self.primitiveType, self.buildMethod, self.masks, self.backgroundBVH, self.maxDuplication)
+        if self.bvh is not None:
+            self.bvh.buildMethod = self.buildMethod
+            self.bvh.maxDuplication = self.maxDuplication
+            self.bvh.masks = self.masks
+            self.bvh.background = self.backgroundBVH
         if self.bvh is not None and update:
             self.bvh.update()
         return self.bvh
 
+    @staticmethod
+    def goc_bvhs(geometries):
+        '''
+            goc_bvh(True) for each geometry, the BVHs being built at once, in parallel (see BVH.update_many())
+        '''
+        bvhs = [g.goc_bvh() for g in geometries]
+        BVH.update_many(bvhs)
+        return bvhs
+
 
 
@@ -0,0 +1,78 @@
+'''
+    CPU rendering of actors, without an OpenGL context (e.g. for thumbnails, or image checks on GPU-less nodes)
+'''
+from QtQmlViewport import Raycaster as PybindRaycaster
+from QtQmlViewport.Geometry import Geometry, PrimitiveType
+from QtQmlViewport.utils import to_numpy
+
+from PyQt5.QtGui import QMatrix4x4, QColor
+import numpy as np
+
+DEFAULT_COLOR = QColor.fromRgbF(.7, .7, .7, 1.0)
+
+def projection_matrix(camera, width, height):
+    '''
+        same projection as Viewport.perspective_matrix(), for a width x height image
+    '''
+    if camera.perspective_override is not None:
+        return camera.perspective_override
+    p = QMatrix4x4()
+    p.perspective(camera.vfov, width/height, camera.near, camera.far)
+    return p
+
+def actor_color(actor):
+    color = actor.effect.shader0.uniforms.get('color') if actor.effect else None
+    return to_numpy(color if isinstance(color, QColor) else DEFAULT_COLOR)
+
+def make_raycaster(actors, camera, width, height, background = QColor("black")):
+    '''
+        returns a Raycaster (see PyBVH) loaded with 'actors'' visible triangles and points geometries,
+        and a list of the actors, indexed by the raycaster's instance ids
+    '''
+    raycaster = PybindRaycaster(width, height)
+    raycaster.set_camera(to_numpy(camera.view_matrix()), to_numpy(projection_matrix(camera, width, height)))
+    raycaster.background = to_numpy(background)
+
+    visible = [(a, tf) for a, tf in actors.get_visible_actors()
+        if a.geometry is not None and a.geometry.indices is not None and a.geometry.attribs.vertices is not None
+        and a.geometry.primitiveType in [PrimitiveType.TRIANGLES, PrimitiveType.POINTS]]
+
+    for a, _ in visible:
+        a.geometry.update()
+    bvhs = Geometry.goc_bvhs([a.geometry for a, _ in visible])
+
+    triangles, points = [], []
+    for (a, parent_tf), bvh in zip(visible, bvhs):
+        snapshot = None if bvh is None else bvh.bvh # in background mode, each bvh.bvh may be a newer snapshot
+        if snapshot is None:
+            continue
+        model = to_numpy(parent_tf * (a.transform.worldTransform() if a.transform else QMatrix4x4()))
+        if bvh.primitiveType == PrimitiveType.TRIANGLES:
+            raycaster.add_triangles(snapshot, model, actor_color(a))
+            triangles.append(a)
+        else:
+            raycaster.add_points(snapshot, model, actor_color(a), a.effect.pointSize if a.effect else 1)
+            points.append(a)
+
+    # triangles instances come first
+    return raycaster, triangles + points
+
+def render(actors, camera, width, height, steps = (8, 4, 2, 1), background = QColor("black")):
+    '''
+        generator, renders progressively: yields after each step (coarsest first) a dict with
+        'depth' (height x width, eye space, inf where nothing was hit), 'normal' (height x width x 3, world space),
+        'ids' (height x width x 2, actor index and primitive id, -1 where nothing was hit), 'color' (height x width x 4, RGBA8),
+        'actors' (actors indexed by 'ids'), 'step', and 'stats' (number of rays, seconds, Mrays/s)
+    '''
+    raycaster, id_to_actors = make_raycaster(actors, camera, width, height, background)
+
+    for step in steps:
+        stats = raycaster.render(step)
+        # images are views on the raycaster's buffers, copy them as the next step overwrites them
+        yield {'depth': raycaster.depths.copy()
+        , 'normal': raycaster.normals.reshape(height, width, 3).copy()
+        , 'ids': raycaster.ids.reshape(height, width, 2).copy()
+        , 'color': raycaster.colors.reshape(height, width, 4).copy()
+        , 'actors': id_to_actors
+        , 'step': step
+        , 'stats': stats}
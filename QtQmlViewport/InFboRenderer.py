@@ -1,4 +1,4 @@
-from QtQmlViewport import Array
+from QtQmlViewport import Array, Profiling
 from QtQmlViewport.utils import LoggingManager
 
 from future.utils import viewitems
@@ -78,24 +78,25 @@ class InFboRenderer( QQuickFramebufferObject.Renderer ):
 
     def map_buffer_object(self, bo, ndarray):
         if bo.dirty:
-            bo.allocate(ndarray.size * ndarray.itemsize)
-            ibo_addr = bo.map(QOpenGLBuffer.WriteOnly)
-            if ibo_addr is not None:
-                c_type = None
-                if ndarray.dtype == np.dtype(np.float32):
-                    c_type = ctypes.c_float
-                elif ndarray.dtype == np.dtype(np.float64):
-                    c_type = ctypes.c_double
-                else:
-                    c_type = getattr(ctypes, 'c_' + str(ndarray.dtype))
-                assert(c_type is not None)
-                ibo_ptr = ctypes.cast(ibo_addr.__int__(), ctypes.POINTER(c_type))
-                ibo_np = np.ctypeslib.as_array(ibo_ptr, shape=ndarray.shape)
-                ibo_np[:] = ndarray
-                bo.unmap()
-            bo.shape = ndarray.shape
-            bo.dtype = ndarray.dtype
-            bo.dirty = False
+            with Profiling.span('InFboRenderer.map_buffer_object'):
+                bo.allocate(ndarray.size * ndarray.itemsize)
+                ibo_addr = bo.map(QOpenGLBuffer.WriteOnly)
+                if ibo_addr is not None:
+                    c_type = None
+                    if ndarray.dtype == np.dtype(np.float32):
+                        c_type = ctypes.c_float
+                    elif ndarray.dtype == np.dtype(np.float64):
+                        c_type = ctypes.c_double
+                    else:
+                        c_type = getattr(ctypes, 'c_' + str(ndarray.dtype))
+                    assert(c_type is not None)
+                    ibo_ptr = ctypes.cast(ibo_addr.__int__(), ctypes.POINTER(c_type))
+                    ibo_np = np.ctypeslib.as_array(ibo_ptr, shape=ndarray.shape)
+                    ibo_np[:] = ndarray
+                    bo.unmap()
+                bo.shape = ndarray.shape
+                bo.dtype = ndarray.dtype
+                bo.dirty = False
     
     def goc_output_texture(self, array):
 
@@ -148,10 +149,11 @@ class InFboRenderer( QQuickFramebufferObject.Renderer ):
             # self.locked_render_to_texture_array.___tex___.destroy()
             self.locked_render_to_texture_array.___tex___.dirty = True
 
+    @Profiling.profiled('InFboRenderer.synchronize')
     def synchronize(self, viewport):
 
-        
-        
+        Profiling.begin_frame()
+
         # This function is called by Qt before calling render()
         # render() will then be called from another thread, which means anything
         # collected here (e.g. sorted_actors) should *not* be accessed during the rendering
@@ -304,6 +306,7 @@ class InFboRenderer( QQuickFramebufferObject.Renderer ):
             
             self.goc_output_texture(self.locked_render_to_texture_array)
 
+    @Profiling.profiled('InFboRenderer.render')
     def render( self ):
         
 
@@ -371,6 +374,8 @@ class InFboRenderer( QQuickFramebufferObject.Renderer ):
                         program.setAttributeBuffer(loc, GL.GL_FLOAT, 0, dim)
                     elif bo.dtype == np.int32:
                         program.setAttributeBuffer(loc, GL.GL_INT, 0, dim)
+                    elif bo.dtype == np.uint8: # normalized, e.g. RGBA8 colors
+                        program.setAttributeBuffer(loc, GL.GL_UNSIGNED_BYTE, 0, dim)
                     else:
                         raise ValueError(f'Unsupported dtype {bo.dtype} for attrib {name}')
                 
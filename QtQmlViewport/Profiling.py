@@ -0,0 +1,95 @@
+'''
+    Frame timeline profiler (see src/Profiler.h), spans recorded from python and from the C++ module
+    (e.g. background BVH builds) end up in the same per-thread ring buffers:
+
+        Profiling.enable()
+        with Profiling.span('my_stage'):
+            ...
+        Profiling.save_trace('trace.json') # open in chrome://tracing or https://ui.perfetto.dev
+        Profiling.report()                 # per frame p50/p99
+
+    Frames are delimited by begin_frame(), which InFboRenderer.synchronize() calls.
+'''
+from QtQmlViewport.PyBVH import profiler
+
+import functools
+
+_ids = {}
+
+def _intern(name):
+    id = _ids.get(name)
+    if id is None:
+        id = _ids[name] = profiler.intern(name)
+    return id
+
+def enable(enabled = True, capacity = 1 << 16):
+    '''
+        capacity: the number of spans kept per thread (older spans are overwritten)
+    '''
+    profiler.enable(enabled, capacity)
+
+def enabled():
+    return profiler.enabled()
+
+def begin_frame():
+    return profiler.begin_frame()
+
+def clear():
+    profiler.clear()
+
+class span(object):
+    '''
+        context manager recording a span named 'name', does nothing when the profiler is disabled
+    '''
+    __slots__ = ('_id', '_begin')
+
+    def __init__(self, name):
+        self._id = _intern(name)
+        self._begin = None
+
+    def __enter__(self):
+        self._begin = profiler.now() if profiler.enabled() else None
+        return self
+
+    def __exit__(self, *args):
+        if self._begin is not None:
+            profiler.record(self._id, self._begin, profiler.now())
+        return False
+
+def profiled(name = None):
+    '''
+        decorator recording a span for each call, named after the function by default
+    '''
+    def decorator(f):
+        span_name = name or f.__qualname__
+        @functools.wraps(f)
+        def wrapper(*args, **kwargs):
+            with span(span_name):
+                return f(*args, **kwargs)
+        return wrapper
+    return decorator
+
+def chrome_trace():
+    '''
+        returns recorded spans as a Chrome trace event format (JSON) string
+    '''
+    return profiler.chrome_trace()
+
+def save_trace(path):
+    with open(path, 'w') as f:
+        f.write(chrome_trace())
+
+def frame_stats():
+    '''
+        returns {name: {'frames', 'spans', 'p50', 'p99', 'max'}}, percentiles of each span's total duration per frame, in ms
+    '''
+    return {name: dict(zip(('frames', 'spans', 'p50', 'p99', 'max'), stats)) for name, stats in profiler.frame_stats().items()}
+
+def report(file = None):
+    '''
+        prints frame_stats(), worst p99 first
+    '''
+    stats = frame_stats()
+    print(f"{'span':<40} {'frames':>8} {'spans':>8} {'p50 ms':>10} {'p99 ms':>10} {'max ms':>10}", file = file)
+    for name, s in sorted(stats.items(), key = lambda item: -item[1]['p99']):
+        print(f"{name:<40} {s['frames']:>8} {s['spans']:>8} {s['p50']:>10.3f} {s['p99']:>10.3f} {s['max']:>10.3f}", file = file)
@@ -1,4 +1,4 @@
-from QtQmlViewport import InFboRenderer, utils, Product, CustomActors
+from QtQmlViewport import InFboRenderer, utils, Product, CustomActors, Profiling
 from QtQmlViewport.Actors import Actors, Renderable
 from QtQmlViewport.Camera import Camera
 from QtQmlViewport.Geometry import Geometry, BVH
@@ -109,15 +109,51 @@ class Viewport( QQuickFramebufferObject ):
         world_direction = (world_origin - cam_origin).normalized()
         return v,h,world_origin,world_direction
     
-    def pick(self, clicked_x, clicked_y, modifiers = None):
+    def pick_tolerance(self, tolerance_px):
+        '''
+            returns (radius, slope) of the picking cone whose section spans 'tolerance_px' pixels at any distance
+        '''
+        # one pixel spans 2 * tan(vfov/2) / height world units per unit of distance from the eye, and the picking ray starts at the near plane
+        slope = tolerance_px * 2 * math.tan( math.radians(self.camera.vfov) / 2 ) / self.height()
+        return slope * self.camera.near, slope
+
+    def local_pick_tolerance(self, radius, slope, world_direction, actor):
+        '''
+            returns the picking cone's (radius, slope) (see pick_tolerance()) in the actor's referential (see to_local()).
+            With a non-uniform scale, the largest scale across the ray is used, so that the tolerance never shrinks
+        '''
+        m_inv = utils.to_numpy(actor.bo_actor["transform"].inverted()[0], np.float64)[:3,:3]
+        d = utils.to_numpy(world_direction, np.float64)
+        d /= np.linalg.norm(d)
+        a = np.cross(d, [1, 0, 0] if abs(d[0]) < 0.9 else [0, 1, 0])
+        a /= np.linalg.norm(a)
+        across = np.linalg.norm(m_inv @ np.stack([a, np.cross(d, a)], axis = 1), 2) # largest singular value
+        along = np.linalg.norm(m_inv @ d) # local units per world unit along the ray
+        # radius at local distance t along the local ray: across * (radius + slope * t / along)
+        return radius * across, slope * across / along
+
+    @Profiling.profiled('Viewport.pick')
+    def pick(self, clicked_x, clicked_y, modifiers = None, include_mask = 0xFFFFFFFF, exclude_mask = 0, tolerance_px = 0):
+        '''
+            include_mask, exclude_mask: only primitives whose mask (see Geometry.masks) has an included bit and no excluded bit are picked
+            tolerance_px: if > 0, primitives within 'tolerance_px' pixels of the picking ray are picked (closest t first), points farther away are ignored
+        '''
 
         v, h, world_origin, world_direction = self.pick_helper(clicked_x, clicked_y)
 
+        if tolerance_px > 0:
+            radius, slope = self.pick_tolerance(tolerance_px)
+
 
         
 
         min_t = float("inf")
         min_result = None
+
+        # build dirty BVHs at once, in parallel
+        Geometry.goc_bvhs([actor._geometry for actor in self.renderer.sorted_actors
+            if actor._geometry and actor.pickable and actor._geometry.indices is not None and actor._geometry.attribs.vertices is not None])
+
         for actor in self.renderer.sorted_actors:
             if actor._geometry and actor.pickable:
                 if actor._geometry.indices is not None\
@@ -127,7 +163,8 @@ class Viewport( QQuickFramebufferObject ):
                     if bvh is None:
                         continue
                     bvh.update()
-                    if bvh.bvh is None:
+                    snapshot = bvh.bvh # in background mode, each bvh.bvh may be a newer snapshot: query and map ids with this one only
+                    if snapshot is None:
                         continue
                     
                     
@@ -135,10 +172,15 @@ class Viewport( QQuickFramebufferObject ):
 
 
                     local_origin_np, local_direction_np = utils.to_numpy(local_origin), utils.to_numpy(local_direction)
+                    if tolerance_px > 0:
+                        local_radius, local_slope = self.local_pick_tolerance(radius, slope, world_direction, actor)
                     # try to intersect the actor's geometry!
                     if bvh.primitiveType == BVH.PrimitiveType.TRIANGLES or bvh.primitiveType == BVH.PrimitiveType.LINES:
 
-                        ids, tuvs = bvh.bvh.intersect_ray(local_origin_np, local_direction_np, True)
+                        if tolerance_px > 0:
+                            ids, _, tuvs = snapshot.cone_cast(local_origin_np, local_direction_np, local_radius, local_slope, True, include_mask, exclude_mask)
+                        else:
+                            ids, tuvs = snapshot.intersect_ray(local_origin_np, local_direction_np, True, include_mask, exclude_mask)
 
                         if ids.size > 0:
                             actor_min_t = tuvs[:,0].min() 
@@ -148,11 +190,19 @@ class Viewport( QQuickFramebufferObject ):
 
                     elif bvh.primitiveType == BVH.PrimitiveType.POINTS:
 
-                        object_id, distance, t = bvh.bvh.ray_distance(local_origin_np, local_direction_np)
+                        if tolerance_px > 0:
+                            ids, distances, ts = snapshot.cone_cast(local_origin_np, local_direction_np, local_radius, local_slope, True, include_mask, exclude_mask)
+                            if ids.size == 0:
+                                continue
+                            object_id, distance, t = ids[0], distances[0], ts[0]
+                        else:
+                            object_id, distance, t = snapshot.ray_distance(local_origin_np, local_direction_np, include_mask, exclude_mask)
+                        if object_id >= snapshot.indices.shape[0]: # nothing matched
+                            continue
                         real_distance = math.sqrt(t**2 + distance**2)
                         if real_distance < min_t:
                             min_t = real_distance
-                            min_result = (actor, bvh.indices.ndarray[object_id, None], np.array([[t, distance, real_distance]]), world_origin, world_direction, local_origin, local_direction)                       
+                            min_result = (actor, snapshot.indices[object_id, :], np.array([[t, distance, real_distance]]), world_origin, world_direction, local_origin, local_direction)                       
                     
         
         if self.debug and modifiers is not None and bool(modifiers & Qt.ShiftModifier):
@@ -1,4 +1,4 @@
-from QtQmlViewport.PyBVH import BVH, PointsBVH
+from QtQmlViewport.PyBVH import BVH, PointsBVH, BuildMethod, BVHHandle, PointsBVHHandle, Raycaster, DEFAULT_MASK
 from QtQmlViewport import linalg
 import numpy as np
 import traceback
@@ -7,7 +7,7 @@ from PyQt5.QtQml import qmlRegisterType, qmlRegisterSingletonType
 
 #generic non-leddar-related modules
 
-from . import Viewport, Camera, Actors, ActorsModel, Geometry, Effect, Array, Transforms, Product, CustomAttribs, CustomEffects
+from . import Profiling, Viewport, Camera, Actors, ActorsModel, Geometry, Effect, Array, Transforms, Product, CustomAttribs, CustomEffects, Headless
 
 
 
@@ -36,6 +36,7 @@ qmlRegisterType(Geometry.Geometry, "Viewport", 1, 0, "Geometry" )
 qmlRegisterType(Geometry.Attribs, "Viewport", 1, 0, "Attribs" )
 qmlRegisterType(CustomAttribs.AmplitudeAttribs, "Viewport", 1, 0, "AmplitudeAttribs" )
 qmlRegisterType(CustomAttribs.ColorsAttribs, "Viewport", 1, 0, "ColorsAttribs" )
+qmlRegisterType(CustomAttribs.ColormapAttribs, "Viewport", 1, 0, "ColormapAttribs" )
 #
 qmlRegisterType(Array.ArrayBase, "Viewport", 1, 0, "ArrayBase")
 qmlRegisterType(Array.ArrayFloat1, "Viewport", 1, 0, "ArrayFloat1" )
@@ -55,18 +56,26 @@ qmlRegisterType(Effect.GLSLProgram, "Viewport", 1, 0, "GLSLProgram" )
 qmlRegisterType(Effect.Effect, "Viewport", 1, 0, "Effect" )
 qmlRegisterSingletonType(CustomEffects.MaterialGLSL, "Viewport", 1, 0, "MaterialGLSL", CustomEffects.get_MaterialGLSL)
 
-def merge_bvhs(bvhs, matrices = None):
-
+def merge_bvhs(bvhs, matrices = None, instance_masks = None):
+    '''
+        instance_masks: optional uint32 mask for each bvh, set on the merged bvh with set_instances()
+        (per-primitive masks of the merged bvhs are preserved, those of bvhs without masks are DEFAULT_MASK)
+    '''
     vertices_list  = []
     triangles_list = []
+    masks_list = []
     
     vertex_offsets = [0]
     for i, bvh in enumerate(bvhs):
         if bvh is None:
             triangles_list.append(np.empty((0,3), 'u4'))
             vertices_list.append(np.empty((0,3), 'f4'))
+            masks_list.append(np.empty((0), 'u4'))
             continue
 
+        masks = bvh.masks
+        masks_list.append(masks if masks.size > 0 else None)
+
         if matrices is not None and matrices[i] is not None:
             vertices_list.append(linalg.map_points(matrices[i], bvh.vertices))
         else:
@@ -88,8 +97,16 @@ def merge_bvhs(bvhs, matrices = None):
         offset_from += t_size
         triangle_offsets.append(offset_from)
 
+    merged = BVH(triangles, vertices)
+
+    if any(m is not None and m.size > 0 for m in masks_list):
+        # bvhs without masks match the queries they matched before merging
+        merged.set_masks(np.hstack([np.full((t.shape[0]), DEFAULT_MASK, 'u4') if m is None else m for m, t in zip(masks_list, triangles_list)]))
+
+    if instance_masks is not None:
+        merged.set_instances(triangles_mapping, np.asarray(instance_masks, 'u4'))
 
-    return BVH(triangles, vertices), triangles_mapping, triangle_offsets, vertex_offsets
+    return merged, triangles_mapping, triangle_offsets, vertex_offsets
 
 BVH.merge_bvhs = staticmethod(merge_bvhs)
 
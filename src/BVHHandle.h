@@ -0,0 +1,220 @@
+/*!
+* RCU-style handle on a BVH: queries run on an immutable snapshot (a shared pointer that keeps the BVH alive for as
+* long as a query holds it), while builds and refits run in the background and are published atomically.
+* Requests are coalesced: while a request runs, only the latest submitted request stays pending.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include "BVHTree.h"
+#include "Profiler.h"
+#include <tbb/task_arena.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace Eigen
+{
+
+/*
+ * BVH must be constructible from (Indices &&, Points &&, BuildMethod, float max_duplication) to build, and from (const BVH &, Points &&) to refit,
+ * and provide set_masks() and freeze(): published BVHs are frozen, their mutators must throw since queries may be running on them
+ */
+template <typename BVH>
+class BVHHandle
+{
+public:
+        typedef std::shared_ptr<BVH> Snapshot;
+        typedef typename BVH::Wrapper::Indices Indices;
+        typedef typename BVH::Wrapper::Points Points;
+        typedef typename BVH::Masks Masks;
+
+        BVHHandle() : _running(false), _submitted(0), _version(0) {}
+
+        ~BVHHandle()
+        {
+            wait_idle();
+        }
+
+        /*
+         * \return the latest published BVH (frozen), or nullptr if none was published yet
+         */
+        Snapshot snapshot() const { return std::atomic_load(&_current); }
+
+        /*
+         * \return the published snapshot's version, 0 if none was published yet
+         */
+        uint64_t version() const { return _version.load(); }
+
+        /*
+         * \return the version of the latest submitted request
+         */
+        uint64_t submitted() const { return _submitted.load(); }
+
+        /*
+         * builds a new BVH in the background, \return the version it will be published with.
+         * 'max_duplication' only applies to BuildMethod::SBVH, see SpatialSplitBVHBuilder
+         */
+        uint64_t build(Indices indices, Points vertices, BuildMethod build_method = BuildMethod::KD, Masks masks = Masks(), float max_duplication = 2.f)
+        {
+            Request request{Request::BUILD, std::move(indices), std::move(vertices), build_method, std::move(masks), max_duplication, 0};
+            return submit(std::move(request));
+        }
+
+        /*
+         * refits the latest built BVH to new vertices in the background (same topology), \return the version it will be published with
+         */
+        uint64_t refit(Points vertices)
+        {
+            Request request{Request::REFIT, Indices(), std::move(vertices), BuildMethod::KD, Masks(), 2.f, 0};
+            return submit(std::move(request));
+        }
+
+        bool pending() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _running;
+        }
+
+        /*
+         * waits for pending requests, rethrows the first error of a background request, if any
+         */
+        void wait()
+        {
+            wait_idle();
+            rethrow();
+        }
+
+        /*
+         * rethrows (once) the first error of the background requests completed so far, if any, without waiting
+         */
+        void rethrow()
+        {
+            std::exception_ptr error;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                std::swap(error, _error);
+            }
+            if(error)
+                std::rethrow_exception(error);
+        }
+
+private:
+        struct Request
+        {
+                enum Kind { BUILD, REFIT } kind;
+                Indices indices;
+                Points vertices;
+                BuildMethod build_method;
+                Masks masks;
+                float max_duplication;
+                uint64_t version;
+        };
+
+        uint64_t submit(Request && request)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            request.version = ++_submitted;
+
+            if(_pending && _pending->kind == Request::BUILD && request.kind == Request::REFIT)
+            {
+                //the refit applies to the pending build's topology
+                _pending->vertices = std::move(request.vertices);
+                _pending->version = request.version;
+            }
+            else
+                _pending.reset(new Request(std::move(request)));
+
+            if(!_running)
+            {
+                _running = true;
+                _arena.enqueue([this]{ drain(); });
+            }
+            return _submitted;
+        }
+
+        void drain()
+        {
+            while(true)
+            {
+                std::unique_ptr<Request> request;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if(!_pending)
+                    {
+                        _running = false;
+                        _idle.notify_all();
+                        return;
+                    }
+                    std::swap(request, _pending);
+                }
+
+                try
+                {
+                    static const uint32_t build_span = profiling::intern("bvh.background_build");
+                    static const uint32_t refit_span = profiling::intern("bvh.background_refit");
+                    profiling::ScopedTimer timer(request->kind == Request::BUILD ? build_span : refit_span);
+
+                    Snapshot bvh;
+                    if(request->kind == Request::BUILD)
+                    {
+                        bvh = std::make_shared<BVH>(std::move(request->indices), std::move(request->vertices), request->build_method, request->max_duplication);
+                        if(request->masks.size() > 0)
+                            bvh->set_masks(request->masks);
+                    }
+                    else
+                    {
+                        Snapshot base = snapshot();
+                        if(!base)
+                            throw std::runtime_error("nothing to refit, build first");
+                        bvh = std::make_shared<BVH>(*base, std::move(request->vertices));
+                    }
+
+                    bvh->freeze(); //still ours only: other threads see it frozen once published
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    publish(std::move(bvh), request->version);
+                }
+                catch(...)
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if(!_error)
+                        _error = std::current_exception();
+                }
+            }
+        }
+
+        void wait_idle()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _idle.wait(lock, [this]{ return !_running; });
+        }
+
+        /*
+         * must be called with _mutex locked, older versions never replace newer ones
+         */
+        void publish(Snapshot bvh, uint64_t version)
+        {
+            if(version <= _version.load())
+                return;
+            std::atomic_store(&_current, std::move(bvh));
+            _version.store(version);
+        }
+
+        mutable std::mutex _mutex;
+        std::condition_variable _idle; //notified when the last pending request completes
+        Snapshot _current;
+        std::unique_ptr<Request> _pending;
+        bool _running;
+        std::exception_ptr _error;
+        std::atomic<uint64_t> _submitted;
+        std::atomic<uint64_t> _version;
+        tbb::task_arena _arena; //requests are enqueued: they run even if nobody waits for them
+};
+
+}
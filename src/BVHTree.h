@@ -0,0 +1,141 @@
+/*!
+* Holds the hierarchy built over a BVHWrapper's objects, with the build method selected at runtime
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include "traits.h"
+#include <Eigen/Dense>
+#include <unsupported/Eigen/BVH>
+#include "FlatBVH.h"
+#include "LinearBVHBuilder.h"
+#include "SpatialSplitBVHBuilder.h"
+#include "MaskedBVH.h"
+#include <memory>
+#include <stdexcept>
+
+namespace Eigen
+{
+
+enum class BuildMethod
+{
+    KD,             //Eigen::KdBVH, serial median split
+    LBVH,           //parallel linear BVH, fastest build
+    LBVH_TREELETS,  //parallel linear BVH followed by treelet restructuring of its larger nodes
+    SBVH            //spatial splits, slowest build, fastest queries on long, thin or overlapping triangles (meant for static meshes)
+};
+
+template <typename BVHWrapper>
+class BVHTree
+{
+public:
+        typedef typename BVHWrapper::Box::Scalar Scalar;
+        typedef KdBVH<Scalar, BVHWrapper::Dim, size_t> KdTree;
+        typedef FlatBVH<Scalar, BVHWrapper::Dim, size_t> FlatTree;
+        typedef typename KdTree::Volume Volume;
+        typedef typename KdTree::Object Object;
+
+        /*
+         * 'max_duplication' only applies to BuildMethod::SBVH, see SpatialSplitBVHBuilder
+         */
+        BVHTree(const BVHWrapper & wrapper, BuildMethod method = BuildMethod::KD, Scalar max_duplication = Scalar(2)) : _method(method)
+        {
+            build(wrapper, max_duplication);
+        }
+
+        /*
+         * copies 'other''s topology and masks, refitted to 'wrapper''s objects, which must be 'other''s objects with new volumes.
+         * Trees that can't be refitted (BuildMethod::KD) are rebuilt.
+         * Refitted spatial split trees (BuildMethod::SBVH) stay correct but lose their clipped volumes' tightness.
+         */
+        BVHTree(const BVHTree & other, const BVHWrapper & wrapper) : _method(other._method)
+        {
+            if(other._flat_tree)
+            {
+                _flat_tree.reset(new FlatTree(*other._flat_tree));
+                _flat_tree->refit(wrapper.boxes_begin());
+                _masks = other._masks;
+            }
+            else
+            {
+                build(wrapper);
+                set_masks(other.masks());
+            }
+        }
+
+        BuildMethod method() const { return _method; }
+
+        /*
+         * calls f(tree) with the concrete tree type, both must yield the same return type
+         */
+        template <typename F>
+        decltype(auto) visit(F && f) const
+        {
+            if(_kd_tree)
+                return f(*_kd_tree);
+            return f(*_flat_tree);
+        }
+
+        /*
+         * calls f(tree) with a tree that only exposes objects (and volumes holding objects) that match 'filter'
+         */
+        template <typename F>
+        decltype(auto) visit(const MaskFilter & filter, F && f) const
+        {
+            return visit([&](const auto & tree)
+            {
+                typedef remove_const_cv_ref<decltype(tree)> Tree;
+                if(_masks.empty())
+                {
+                    static const FlatTree empty;
+                    return filter.matches(BVHMasks::DEFAULT_MASK) ? f(tree) : f(empty);
+                }
+                return f(MaskedBVH<Tree>(tree, _masks, filter));
+            });
+        }
+
+        /*
+         * sets objects' masks (one per object), an empty vector resets all masks to BVHMasks::DEFAULT_MASK
+         */
+        void set_masks(std::vector<uint32_t> masks)
+        {
+            _masks.objects = std::move(masks);
+            if(_masks.empty())
+                _masks.clear();
+            else
+                visit([&](const auto & tree){_masks.aggregate(tree);});
+        }
+
+        const std::vector<uint32_t> & masks() const { return _masks.objects; }
+
+private:
+        void build(const BVHWrapper & wrapper, Scalar max_duplication = Scalar(2))
+        {
+            switch(_method)
+            {
+                case BuildMethod::KD:
+                    _kd_tree.reset(new KdTree(wrapper.begin(), wrapper.end(), wrapper.boxes_begin(), wrapper.boxes_end()));
+                    break;
+                case BuildMethod::LBVH:
+                case BuildMethod::LBVH_TREELETS:
+                    _flat_tree.reset(new FlatTree());
+                    build_linear_bvh(*_flat_tree, wrapper.begin(), wrapper.end(), wrapper.boxes_begin(), wrapper.boxes_end()
+                            , _method == BuildMethod::LBVH_TREELETS);
+                    break;
+                case BuildMethod::SBVH:
+                    _flat_tree.reset(new FlatTree());
+                    build_spatial_split_bvh(*_flat_tree, wrapper, max_duplication);
+                    break;
+                default:
+                    throw std::invalid_argument("unknown build method");
+            }
+        }
+
+        BuildMethod _method;
+        std::unique_ptr<KdTree> _kd_tree;
+        std::unique_ptr<FlatTree> _flat_tree;
+        BVHMasks _masks;
+};
+
+}
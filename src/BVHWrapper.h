@@ -6,6 +6,7 @@
 #pragma once
 
 #include <Eigen/Dense>
+#include <tbb/parallel_for.h>
 #include <vector>
 #include <array>
 #include <numeric>
@@ -42,16 +43,16 @@ public:
         void init()
         {
             size_t n_objects = _indices.rows();
-            _boxes.reserve(n_objects);
-            for(size_t i = 0; i < n_objects; i++)
+            _boxes.resize(n_objects);
+            tbb::parallel_for(size_t(0), n_objects, [&](size_t i)
             {
                 AlignedBox<Scalar, Dim> box;
                 
                 for(size_t j = 0; j < ShapeDim; j++)
                     box.extend(_points.row(_indices(i, j)).transpose());
 
-                _boxes.emplace_back(box);
-            }
+                _boxes[i] = box;
+            });
 
             _objects.resize(n_objects);
             std::iota(_objects.begin(), _objects.end(), 0u);
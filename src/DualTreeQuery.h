@@ -0,0 +1,250 @@
+/*!
+* Simultaneous traversal of two hierarchies, to find pairs of objects that overlap, or that are within
+* a given distance. The second tree is mapped in the first tree's referential by an affine transform.
+* Traversal spawns TBB tasks down to SPAWN_DEPTH.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include "triangle_intersections.h"
+#include "triangle_distances.h"
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <tbb/task_group.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+namespace Eigen
+{
+
+template <typename ObjectA, typename ObjectB, typename Scalar>
+struct ObjectPair
+{
+        ObjectA first;
+        ObjectB second;
+        Scalar distance;
+};
+
+/*
+ * PairTest must provide:
+ *  Scalar margin() const                      // volumes farther apart than the margin are pruned
+ *  bool test(ObjectA, ObjectB, Scalar & distance) const // true if the pair must be reported
+ */
+template <typename TreeA, typename BoxIterA, typename TreeB, typename BoxIterB, typename PairTest>
+class DualTreeQuery
+{
+public:
+        typedef typename TreeA::Scalar Scalar;
+        typedef typename TreeA::Volume Volume;
+        typedef Matrix<Scalar, 3, 1> Vector;
+        typedef Transform<Scalar, 3, Affine> AffineTransform;
+        typedef ObjectPair<typename TreeA::Object, typename TreeB::Object, Scalar> Pair;
+        typedef std::vector<Pair> Pairs;
+
+        static constexpr int SPAWN_DEPTH = 12;
+
+        DualTreeQuery(const TreeA & a, BoxIterA a_boxes, const TreeB & b, BoxIterB b_boxes, const AffineTransform & b_to_a, const PairTest & test) :
+            _a(a), _a_boxes(a_boxes), _b(b), _b_boxes(b_boxes), _b_to_a(b_to_a), _test(test)
+        {
+        }
+
+        /*
+         * \return reported pairs, sorted by first, then second object, without duplicates
+         */
+        Pairs pairs()
+        {
+            traverse(Item<TreeA>::root(_a), Item<TreeB>::root(_b), 0);
+            _group.wait();
+
+            Pairs pairs;
+            for(const auto & local : _pairs)
+                pairs.insert(pairs.end(), local.begin(), local.end());
+            std::sort(pairs.begin(), pairs.end(), [](const Pair & lhs, const Pair & rhs)
+            {
+                return std::tie(lhs.first, lhs.second) < std::tie(rhs.first, rhs.second);
+            });
+            //spatial split trees may reference an object from several leaves
+            pairs.erase(std::unique(pairs.begin(), pairs.end(), [](const Pair & lhs, const Pair & rhs)
+            {
+                return lhs.first == rhs.first && lhs.second == rhs.second;
+            }), pairs.end());
+            return pairs;
+        }
+
+private:
+        /*
+         * a volume or an object of a tree. A volume with a negative index stands for a tree with less than two objects
+         */
+        template <typename Tree>
+        struct Item
+        {
+                typename Tree::Index volume;
+                typename Tree::Object object;
+                bool is_object;
+
+                static Item root(const Tree & tree) { return Item{tree.getRootIndex(), typename Tree::Object(), false}; }
+                static Item from_volume(typename Tree::Index volume) { return Item{volume, typename Tree::Object(), false}; }
+                static Item from_object(const typename Tree::Object & object) { return Item{-1, object, true}; }
+                bool is_pseudo_root() const { return !is_object && volume < 0; }
+        };
+
+        Volume volume_a(const Item<TreeA> & item) const
+        {
+            return item.is_object ? Volume(_a_boxes[item.object]) : _a.getVolume(item.volume);
+        }
+
+        Volume volume_b(const Item<TreeB> & item) const
+        {
+            const Volume box = item.is_object ? Volume(_b_boxes[item.object]) : _b.getVolume(item.volume);
+            const Vector center = _b_to_a * box.center();
+            const Vector half_extents = _b_to_a.linear().cwiseAbs() * (box.sizes() / 2);
+            return Volume(center - half_extents, center + half_extents);
+        }
+
+        static Scalar distance(const Volume & lhs, const Volume & rhs)
+        {
+            Vector gaps = (lhs.min() - rhs.max()).cwiseMax(rhs.min() - lhs.max()).cwiseMax(Vector::Zero());
+            return gaps.norm();
+        }
+
+        template <typename Tree, typename F>
+        static void for_each_child(const Tree & tree, typename Tree::Index volume, F f)
+        {
+            typename Tree::VolumeIterator vBegin = typename Tree::VolumeIterator(), vEnd = typename Tree::VolumeIterator();
+            typename Tree::ObjectIterator oBegin = typename Tree::ObjectIterator(), oEnd = typename Tree::ObjectIterator();
+            tree.getChildren(volume, vBegin, vEnd, oBegin, oEnd);
+            for(; vBegin != vEnd; ++vBegin)
+                f(Item<Tree>::from_volume(*vBegin));
+            for(; oBegin != oEnd; ++oBegin)
+                f(Item<Tree>::from_object(*oBegin));
+        }
+
+        template <typename F>
+        void run(int depth, F && f)
+        {
+            if(depth < SPAWN_DEPTH)
+                _group.run(std::forward<F>(f));
+            else
+                f();
+        }
+
+        void traverse(const Item<TreeA> & a, const Item<TreeB> & b, int depth)
+        {
+            if(!a.is_pseudo_root() && !b.is_pseudo_root())
+            {
+                const Volume va = volume_a(a), vb = volume_b(b);
+                if(distance(va, vb) > _test.margin())
+                    return;
+
+                if(a.is_object && b.is_object)
+                {
+                    Scalar d;
+                    if(_test.test(a.object, b.object, d))
+                        _pairs.local().emplace_back(Pair{a.object, b.object, d});
+                    return;
+                }
+            }
+
+            //descend the volume of the largest extent
+            bool split_a;
+            if(a.is_object || b.is_object)
+                split_a = b.is_object;
+            else if(a.is_pseudo_root() || b.is_pseudo_root())
+                split_a = a.is_pseudo_root();
+            else
+                split_a = volume_a(a).sizes().squaredNorm() >= volume_b(b).sizes().squaredNorm();
+
+            if(split_a)
+                for_each_child(_a, a.volume, [&](const Item<TreeA> & child)
+                {
+                    run(depth, [this, child, b, depth]{traverse(child, b, depth + 1);});
+                });
+            else
+                for_each_child(_b, b.volume, [&](const Item<TreeB> & child)
+                {
+                    run(depth, [this, a, child, depth]{traverse(a, child, depth + 1);});
+                });
+        }
+
+        const TreeA & _a;
+        BoxIterA _a_boxes;
+        const TreeB & _b;
+        BoxIterB _b_boxes;
+        const AffineTransform _b_to_a;
+        const PairTest & _test;
+        tbb::task_group _group;
+        tbb::enumerable_thread_specific<Pairs> _pairs;
+};
+
+template <typename TreeA, typename BoxIterA, typename TreeB, typename BoxIterB, typename PairTest>
+decltype(auto) dual_tree_pairs(const TreeA & a, BoxIterA a_boxes, const TreeB & b, BoxIterB b_boxes
+        , const Transform<typename TreeA::Scalar, 3, Affine> & b_to_a, const PairTest & test)
+{
+    return DualTreeQuery<TreeA, BoxIterA, TreeB, BoxIterB, PairTest>(a, a_boxes, b, b_boxes, b_to_a, test).pairs();
+}
+
+/*
+ * Pairs of triangles that intersect, or that are within 'max_distance' if it is positive
+ */
+template <typename WrapperA, typename WrapperB>
+struct TrianglesPairTest
+{
+        typedef typename WrapperA::Box::Scalar Scalar;
+        typedef Matrix<Scalar, 3, 1> Vector;
+
+        const WrapperA & a;
+        const WrapperB & b;
+        Transform<Scalar, 3, Affine> b_to_a;
+        Scalar max_distance;
+
+        Scalar margin() const { return max_distance; }
+
+        bool test(size_t object_a, size_t object_b, Scalar & distance) const
+        {
+            auto ta = a.indices(object_a);
+            auto tb = b.indices(object_b);
+            const Vector a0 = a.point(ta[0]).transpose(), a1 = a.point(ta[1]).transpose(), a2 = a.point(ta[2]).transpose();
+            const Vector b0 = b_to_a * Vector(b.point(tb[0]).transpose())
+                       , b1 = b_to_a * Vector(b.point(tb[1]).transpose())
+                       , b2 = b_to_a * Vector(b.point(tb[2]).transpose());
+
+            if(max_distance <= 0)
+            {
+                distance = 0;
+                return intersections::intersect_triangle_triangle(a0, a1, a2, b0, b1, b2);
+            }
+            distance = distances::triangle_triangle_distance(a0, a1, a2, b0, b1, b2);
+            return distance <= max_distance;
+        }
+};
+
+/*
+ * Pairs of triangle and point within 'max_distance'
+ */
+template <typename WrapperA, typename WrapperB>
+struct TrianglePointPairTest
+{
+        typedef typename WrapperA::Box::Scalar Scalar;
+        typedef Matrix<Scalar, 3, 1> Vector;
+
+        const WrapperA & a;
+        const WrapperB & b;
+        Transform<Scalar, 3, Affine> b_to_a;
+        Scalar max_distance;
+
+        Scalar margin() const { return max_distance; }
+
+        bool test(size_t object_a, size_t object_b, Scalar & distance) const
+        {
+            auto ta = a.indices(object_a);
+            const Vector p = b_to_a * Vector(b.point(b.indices(object_b)[0]).transpose());
+            distance = distances::point_triangle_distance(p
+                , Vector(a.point(ta[0]).transpose()), Vector(a.point(ta[1]).transpose()), Vector(a.point(ta[2]).transpose()));
+            return distance <= max_distance;
+        }
+};
+
+}
@@ -0,0 +1,143 @@
+/*!
+* Binary bounding volume hierarchy stored as a flat array of nodes, filled by external builders
+* (see LinearBVHBuilder.h). Exposes the same traversal interface as Eigen::KdBVH,
+* so BVIntersect() and BVMinimize() work unchanged.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <tbb/parallel_for.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Eigen
+{
+
+template <typename _Scalar, int _Dim, typename _Object>
+class FlatBVH
+{
+public:
+        enum { Dim = _Dim };
+        typedef _Object Object;
+        typedef _Scalar Scalar;
+        typedef AlignedBox<Scalar, Dim> Volume;
+        typedef std::vector<Volume, aligned_allocator<Volume> > VolumeList;
+        typedef std::vector<Object, aligned_allocator<Object> > ObjectList;
+        typedef int Index;
+        typedef const int *VolumeIterator;
+        typedef const Object *ObjectIterator;
+
+        /*
+         * An internal node, its volume is stored separately in 'boxes'.
+         * children[k] is the index of an internal node, or -1 if the k-th child is objects[k]
+         */
+        struct Node
+        {
+                int children[2];
+                Object objects[2];
+                int parent;
+        };
+        typedef std::vector<Node> Nodes;
+
+        FlatBVH() {}
+
+        /*
+         * Resets the tree for n_objects objects (n_objects - 1 internal nodes).
+         * Trees with less than 2 objects have no internal nodes, their objects are stored in 'objects'.
+         */
+        void reset(size_t n_objects)
+        {
+            nodes.clear();
+            boxes.clear();
+            objects.clear();
+            if(n_objects > 1)
+            {
+                nodes.resize(n_objects - 1);
+                boxes.resize(n_objects - 1);
+            }
+        }
+
+        inline Index getRootIndex() const { return nodes.empty() ? -1 : 0; }
+
+        EIGEN_STRONG_INLINE void getChildren(Index index, VolumeIterator &outVBegin, VolumeIterator &outVEnd,
+                                             ObjectIterator &outOBegin, ObjectIterator &outOEnd) const
+        {
+            if(index < 0)
+            {
+                outVBegin = outVEnd;
+                outOBegin = objects.data();
+                outOEnd = outOBegin + objects.size();
+                return;
+            }
+            const Node & node = nodes[index];
+            if(node.children[0] >= 0 && node.children[1] >= 0)
+            {
+                outVBegin = &node.children[0];
+                outVEnd = outVBegin + 2;
+                outOBegin = outOEnd;
+            }
+            else if(node.children[0] < 0 && node.children[1] < 0)
+            {
+                outVBegin = outVEnd;
+                outOBegin = &node.objects[0];
+                outOEnd = outOBegin + 2;
+            }
+            else
+            {
+                const int v = node.children[0] >= 0 ? 0 : 1;
+                outVBegin = &node.children[v];
+                outVEnd = outVBegin + 1;
+                outOBegin = &node.objects[1 - v];
+                outOEnd = outOBegin + 1;
+            }
+        }
+
+        inline const Volume &getVolume(Index index) const { return boxes[index]; }
+
+        size_t n_nodes() const { return nodes.size(); }
+
+        /*
+         * Recomputes the volumes of the current topology from objects' new volumes (e.g. after their vertices moved),
+         * in a parallel bottom-up pass: the last of a node's internal children to complete refits the node
+         */
+        template <typename BIter>
+        void refit(BIter boxes_begin)
+        {
+            const size_t n = nodes.size();
+            std::unique_ptr<std::atomic<int>[]> pending(new std::atomic<int>[n]);
+            std::vector<int> leaves; //nodes without internal children, where passes start
+            for(size_t i = 0; i < n; i++)
+            {
+                const int n_internal = int(nodes[i].children[0] >= 0) + int(nodes[i].children[1] >= 0);
+                pending[i].store(n_internal, std::memory_order_relaxed);
+                if(n_internal == 0)
+                    leaves.push_back(int(i));
+            }
+
+            tbb::parallel_for(size_t(0), leaves.size(), [&](size_t i)
+            {
+                int node = leaves[i];
+                while(node >= 0)
+                {
+                    const Node & current = nodes[node];
+                    Volume box;
+                    for(int k = 0; k < 2; k++)
+                        box.extend(current.children[k] >= 0 ? boxes[current.children[k]] : Volume(*(boxes_begin + current.objects[k])));
+                    boxes[node] = box;
+
+                    node = current.parent;
+                    if(node >= 0 && pending[node].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                        return; //the other child is not ready yet
+                }
+            });
+        }
+
+        Nodes nodes;
+        VolumeList boxes;
+        ObjectList objects; //only used when the tree has less than 2 objects
+};
+
+}
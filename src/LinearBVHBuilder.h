@@ -0,0 +1,386 @@
+/*!
+* Linear BVH (LBVH) builder for FlatBVH:
+* parallel morton codes, parallel radix sort and parallel hierarchy emission, as described in
+* Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees", HPG 2012.
+* The hierarchy can optionally be restructured with treelets, as described in
+* Karras and Aila, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies", HPG 2013.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include "FlatBVH.h"
+#include "morton.h"
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace Eigen
+{
+
+template <typename Tree>
+class LinearBVHBuilder
+{
+public:
+        typedef typename Tree::Scalar Scalar;
+        typedef typename Tree::Volume Volume;
+        typedef typename Tree::Object Object;
+        typedef typename Tree::Node Node;
+        typedef typename Tree::VolumeList VolumeList;
+
+        static constexpr int TREELET_LEAVES = 7;
+        static constexpr int TREELET_MIN_OBJECTS = 32;
+        static constexpr Scalar NODE_COST = Scalar(1.2);
+        static constexpr Scalar OBJECT_COST = Scalar(1);
+
+        /*
+         * 'treelet_min_objects': only the nodes holding at least that many objects are treelet roots. Restructuring
+         * every node (TREELET_LEAVES) costs several times the build, while most of the gain is on the larger nodes
+         */
+        LinearBVHBuilder(Tree & tree, bool optimize_treelets = false, int treelet_min_objects = TREELET_MIN_OBJECTS) :
+            _tree(tree), _optimize_treelets(optimize_treelets), _treelet_min_objects(std::max(treelet_min_objects, int(TREELET_LEAVES)))
+        {
+            static_assert(Tree::Dim == 3, "morton codes are only implemented in 3D");
+        }
+
+        template <typename OIter, typename BIter>
+        void build(OIter begin, OIter end, BIter boxes_begin, BIter boxes_end)
+        {
+            const size_t n = std::distance(begin, end);
+            if(size_t(std::distance(boxes_begin, boxes_end)) != n)
+                throw std::invalid_argument("expected one box per object");
+            _tree.reset(n);
+            if(n < 2)
+            {
+                _tree.objects.assign(begin, end);
+                return;
+            }
+
+            std::vector<uint32_t> codes;
+            std::vector<uint32_t> order; //32 bits, like nodes' indices: the sort moves half as many bytes
+            sort_by_morton_codes(boxes_begin, n, codes, order);
+
+            _boxes.resize(n);
+            _objects.resize(n);
+            tbb::parallel_for(size_t(0), n, [&](size_t i)
+            {
+                _boxes[i] = *(boxes_begin + order[i]);
+                _objects[i] = *(begin + order[i]);
+            });
+
+            emit_hierarchy(codes);
+            compute_volumes();
+        }
+
+private:
+        template <typename BIter>
+        void sort_by_morton_codes(BIter boxes_begin, size_t n, std::vector<uint32_t> & codes, std::vector<uint32_t> & order)
+        {
+            Volume bounds = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, n), Volume()
+            , [&](const tbb::blocked_range<size_t> & r, Volume b)
+            {
+                for(size_t i = r.begin(); i < r.end(); i++)
+                    b.extend((boxes_begin + i)->center());
+                return b;
+            }
+            , [](const Volume & a, const Volume & b){return a.merged(b);});
+
+            codes.resize(n);
+            order.resize(n);
+            tbb::parallel_for(size_t(0), n, [&](size_t i)
+            {
+                codes[i] = morton::code<Scalar>((boxes_begin + i)->center(), bounds);
+                order[i] = uint32_t(i);
+            });
+
+            morton::radix_sort(codes, order, 30);
+        }
+
+        /*
+         * length of the common prefix of codes i and j, -1 if j is out of range.
+         * Duplicate codes are disambiguated with their index
+         */
+        static int delta(const std::vector<uint32_t> & codes, int i, int j)
+        {
+            if(j < 0 || j >= int(codes.size()))
+                return -1;
+            if(codes[i] == codes[j])
+                return 32 + morton::clz(uint32_t(i) ^ uint32_t(j));
+            return morton::clz(codes[i] ^ codes[j]);
+        }
+
+        void emit_hierarchy(const std::vector<uint32_t> & codes)
+        {
+            const int n = int(codes.size());
+            _leaf_parents.resize(n);
+            _leaves.resize(2 * (n - 1));
+            _tree.nodes[0].parent = -1;
+
+            tbb::parallel_for(0, n - 1, [&](int i)
+            {
+                //direction of the range
+                const int d = delta(codes, i, i + 1) > delta(codes, i, i - 1) ? 1 : -1;
+
+                //upper bound for the length of the range
+                const int delta_min = delta(codes, i, i - d);
+                int l_max = 2;
+                while(delta(codes, i, i + l_max * d) > delta_min)
+                    l_max *= 2;
+
+                //other end of the range, using binary search
+                int l = 0;
+                for(int t = l_max / 2; t >= 1; t /= 2)
+                    if(delta(codes, i, i + (l + t) * d) > delta_min)
+                        l += t;
+                const int j = i + l * d;
+
+                //split position, using binary search
+                const int delta_node = delta(codes, i, j);
+                int s = 0;
+                for(int div = 2; ; div *= 2)
+                {
+                    int t = (l + div - 1) / div;
+                    if(delta(codes, i, i + (s + t) * d) > delta_node)
+                        s += t;
+                    if(t == 1)
+                        break;
+                }
+                const int gamma = i + s * d + std::min(d, 0);
+
+                Node & node = _tree.nodes[i];
+                const int split[2] = {gamma, gamma + 1};
+                const bool is_leaf[2] = {std::min(i, j) == gamma, std::max(i, j) == gamma + 1};
+                for(int k = 0; k < 2; k++)
+                {
+                    if(is_leaf[k])
+                    {
+                        node.children[k] = -1;
+                        node.objects[k] = _objects[split[k]];
+                        _leaves[2 * i + k] = split[k];
+                        _leaf_parents[split[k]] = i;
+                    }
+                    else
+                    {
+                        node.children[k] = split[k];
+                        _tree.nodes[split[k]].parent = i;
+                    }
+                }
+            });
+        }
+
+        /*
+         * Bottom-up pass: the last of a node's two children to complete computes the node's volume
+         */
+        void compute_volumes()
+        {
+            const size_t n = _objects.size();
+            std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[n - 1]);
+            for(size_t i = 0; i < n - 1; i++)
+                visits[i].store(0, std::memory_order_relaxed);
+
+            _costs.resize(n - 1);
+            _counts.resize(n - 1);
+
+            tbb::parallel_for(size_t(0), n, [&](size_t leaf)
+            {
+                int node = _leaf_parents[leaf];
+                while(node >= 0)
+                {
+                    if(visits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+                        return; //the other child is not ready yet
+
+                    update_node(node);
+                    if(_optimize_treelets && _counts[node] >= _treelet_min_objects)
+                        optimize_treelet(node);
+
+                    node = _tree.nodes[node].parent;
+                }
+            });
+        }
+
+        static Scalar area(const Volume & box)
+        {
+            auto e = box.sizes();
+            return 2 * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+        }
+
+        /*
+         * A child slot of a treelet, either an internal node or a leaf (an object)
+         */
+        struct Handle
+        {
+                int node;
+                int leaf;
+        };
+
+        Handle child(int node, int k) const
+        {
+            return Handle{_tree.nodes[node].children[k], _leaves[2 * node + k]};
+        }
+
+        const Volume & volume(const Handle & h) const
+        {
+            return h.node >= 0 ? _tree.boxes[h.node] : _boxes[h.leaf];
+        }
+
+        Scalar cost(const Handle & h) const
+        {
+            return h.node >= 0 ? _costs[h.node] : OBJECT_COST * area(_boxes[h.leaf]);
+        }
+
+        int count(const Handle & h) const
+        {
+            return h.node >= 0 ? _counts[h.node] : 1;
+        }
+
+        void update_node(int node)
+        {
+            Handle l = child(node, 0), r = child(node, 1);
+            _tree.boxes[node] = volume(l).merged(volume(r));
+            _costs[node] = NODE_COST * area(_tree.boxes[node]) + cost(l) + cost(r);
+            _counts[node] = count(l) + count(r);
+        }
+
+        void set_child(int node, int k, const Handle & h)
+        {
+            Node & n = _tree.nodes[node];
+            n.children[k] = h.node;
+            _leaves[2 * node + k] = h.leaf;
+            if(h.node >= 0)
+                _tree.nodes[h.node].parent = node;
+            else
+                n.objects[k] = _objects[h.leaf];
+        }
+
+        /*
+         * Finds the treelet topology minimizing the surface area heuristic, using dynamic programming
+         * over all subsets of the treelet's leaves, then rewires the treelet's internal nodes accordingly
+         */
+        void optimize_treelet(int root)
+        {
+            constexpr int N_SUBSETS = 1 << TREELET_LEAVES;
+
+            Handle leaves[TREELET_LEAVES] = {child(root, 0), child(root, 1)};
+            int n_leaves = 2;
+            int internals[TREELET_LEAVES - 1] = {root};
+            int n_internals = 1;
+
+            //grow the treelet by expanding the leaf with the largest surface area
+            while(n_leaves < TREELET_LEAVES)
+            {
+                int best = -1;
+                Scalar best_area = -1;
+                for(int i = 0; i < n_leaves; i++)
+                {
+                    if(leaves[i].node < 0)
+                        continue;
+                    Scalar a = area(_tree.boxes[leaves[i].node]);
+                    if(a > best_area)
+                    {
+                        best_area = a;
+                        best = i;
+                    }
+                }
+                if(best < 0)
+                    break;
+                int expanded = leaves[best].node;
+                internals[n_internals++] = expanded;
+                leaves[best] = child(expanded, 0);
+                leaves[n_leaves++] = child(expanded, 1);
+            }
+
+            const int full = (1 << n_leaves) - 1;
+            Volume boxes[N_SUBSETS];
+            Scalar costs[N_SUBSETS];
+            int partitions[N_SUBSETS];
+
+            for(int s = 1; s <= full; s++)
+            {
+                int lowest = s & -s;
+                if(s == lowest)
+                {
+                    int i = 0;
+                    while((1 << i) != s)
+                        i++;
+                    boxes[s] = volume(leaves[i]);
+                    costs[s] = cost(leaves[i]);
+                    continue;
+                }
+                boxes[s] = boxes[lowest].merged(boxes[s ^ lowest]);
+
+                //only enumerate partitions holding the lowest leaf, the others are their mirror
+                const int others = s ^ lowest;
+                Scalar best_cost = std::numeric_limits<Scalar>::max();
+                int best_partition = lowest;
+                for(int q = (others - 1) & others; ; q = (q - 1) & others)
+                {
+                    const int p = q | lowest;
+                    Scalar c = costs[p] + costs[s ^ p];
+                    if(c < best_cost)
+                    {
+                        best_cost = c;
+                        best_partition = p;
+                    }
+                    if(q == 0)
+                        break;
+                }
+                costs[s] = NODE_COST * area(boxes[s]) + best_cost;
+                partitions[s] = best_partition;
+            }
+
+            if(!(costs[full] < _costs[root] * Scalar(0.999)))
+                return;
+
+            int next_internal = 1;
+            emit_treelet(root, full, leaves, partitions, internals, next_internal);
+        }
+
+        void emit_treelet(int node, int subset, const Handle * leaves, const int * partitions, const int * internals, int & next_internal)
+        {
+            const int parts[2] = {partitions[subset], subset ^ partitions[subset]};
+            for(int k = 0; k < 2; k++)
+            {
+                if((parts[k] & (parts[k] - 1)) == 0)
+                {
+                    int i = 0;
+                    while((1 << i) != parts[k])
+                        i++;
+                    set_child(node, k, leaves[i]);
+                }
+                else
+                {
+                    int internal = internals[next_internal++];
+                    set_child(node, k, Handle{internal, -1});
+                    emit_treelet(internal, parts[k], leaves, partitions, internals, next_internal);
+                }
+            }
+            update_node(node);
+        }
+
+        Tree & _tree;
+        bool _optimize_treelets;
+        int _treelet_min_objects;
+        VolumeList _boxes; //objects' volumes, in morton order
+        std::vector<Object> _objects; //objects, in morton order
+        std::vector<int> _leaves; //for each node's children slots, the leaf index (in morton order) if it is an object
+        std::vector<int> _leaf_parents;
+        std::vector<Scalar> _costs;
+        std::vector<int> _counts;
+};
+
+/*
+ * Builds a FlatBVH over [begin, end) objects, whose volumes are [boxes_begin, boxes_end)
+ */
+template <typename Tree, typename OIter, typename BIter>
+void build_linear_bvh(Tree & tree, OIter begin, OIter end, BIter boxes_begin, BIter boxes_end, bool optimize_treelets = false)
+{
+    LinearBVHBuilder<Tree>(tree, optimize_treelets).build(begin, end, boxes_begin, boxes_end);
+}
+
+}
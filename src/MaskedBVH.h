@@ -0,0 +1,228 @@
+/*!
+* Per-object bit masks, aggregated per volume, and a tree adaptor that hides the volumes and objects
+* that can't match a query's include/exclude masks, so that BVIntersect() and BVMinimize() prune them
+* without visiting them.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace Eigen
+{
+
+/*
+ * An object matches if it has at least one 'include' bit, and no 'exclude' bit
+ */
+struct MaskFilter
+{
+        uint32_t include;
+        uint32_t exclude;
+
+        bool matches(uint32_t mask) const
+        {
+            return (mask & include) != 0 && (mask & exclude) == 0;
+        }
+
+        /*
+         * \param any the union of a volume's objects' masks
+         * \param all the intersection of a volume's objects' masks
+         * \return false if none of the volume's objects can match
+         */
+        bool may_match(uint32_t any, uint32_t all) const
+        {
+            return (any & include) != 0 && (all & exclude) == 0;
+        }
+};
+
+/*
+ * Objects' masks, and their union and intersection for each volume of a tree
+ */
+class BVHMasks
+{
+public:
+        static constexpr uint32_t DEFAULT_MASK = 1u;
+
+        bool empty() const { return objects.empty(); }
+
+        void clear()
+        {
+            objects.clear();
+            any.clear();
+            all.clear();
+        }
+
+        template <typename Tree>
+        void aggregate(const Tree & tree)
+        {
+            any.clear();
+            all.clear();
+            if(tree.getRootIndex() >= 0)
+                aggregate(tree, tree.getRootIndex());
+        }
+
+        std::vector<uint32_t> objects;
+        std::vector<uint32_t> any;
+        std::vector<uint32_t> all;
+
+private:
+        template <typename Tree>
+        std::pair<uint32_t, uint32_t> aggregate(const Tree & tree, typename Tree::Index index)
+        {
+            typename Tree::VolumeIterator vBegin = typename Tree::VolumeIterator(), vEnd = typename Tree::VolumeIterator();
+            typename Tree::ObjectIterator oBegin = typename Tree::ObjectIterator(), oEnd = typename Tree::ObjectIterator();
+            tree.getChildren(index, vBegin, vEnd, oBegin, oEnd);
+
+            uint32_t any_mask = 0u, all_mask = ~0u;
+            for(; vBegin != vEnd; ++vBegin)
+            {
+                auto child = aggregate(tree, *vBegin);
+                any_mask |= child.first;
+                all_mask &= child.second;
+            }
+            for(; oBegin != oEnd; ++oBegin)
+            {
+                any_mask |= objects[*oBegin];
+                all_mask &= objects[*oBegin];
+            }
+
+            if(size_t(index) >= any.size())
+            {
+                any.resize(index + 1);
+                all.resize(index + 1);
+            }
+            any[index] = any_mask;
+            all[index] = all_mask;
+            return std::make_pair(any_mask, all_mask);
+        }
+};
+
+/*
+ * Per-primitive masks and per-instance masks (each primitive belonging to an instance), combined
+ * into objects' masks by and-ing them. Without per-primitive masks, primitives have BVHMasks::DEFAULT_MASK,
+ * as in trees without masks.
+ */
+struct MaskSources
+{
+        std::vector<uint32_t> primitive_masks;
+        std::vector<uint32_t> instance_ids;
+        std::vector<uint32_t> instance_masks;
+
+        /*
+         * \return objects' masks, empty if neither per-primitive nor per-instance masks were given
+         */
+        std::vector<uint32_t> combine(size_t n_objects) const
+        {
+            if(primitive_masks.empty() && instance_ids.empty())
+                return {};
+
+            if(!primitive_masks.empty() && primitive_masks.size() != n_objects)
+                throw std::invalid_argument("expected one mask per primitive");
+            if(!instance_ids.empty() && instance_ids.size() != n_objects)
+                throw std::invalid_argument("expected one instance id per primitive");
+
+            std::vector<uint32_t> masks(n_objects);
+            for(size_t i = 0; i < n_objects; i++)
+            {
+                uint32_t mask = primitive_masks.empty() ? BVHMasks::DEFAULT_MASK : primitive_masks[i];
+                if(!instance_ids.empty())
+                {
+                    if(instance_ids[i] >= instance_masks.size())
+                        throw std::invalid_argument("instance id out of range");
+                    mask &= instance_masks[instance_ids[i]];
+                }
+                masks[i] = mask;
+            }
+            return masks;
+        }
+};
+
+/*
+ * Iterates over the elements of [begin, end) satisfying a predicate
+ */
+template <typename Iter, typename Predicate>
+class FilterIterator
+{
+public:
+        FilterIterator() : _it(), _end(), _predicate(nullptr) {}
+        FilterIterator(Iter it, Iter end, const Predicate * predicate) : _it(it), _end(end), _predicate(predicate) { skip(); }
+
+        decltype(auto) operator*() const { return *_it; }
+        FilterIterator & operator++() { ++_it; skip(); return *this; }
+        bool operator==(const FilterIterator & other) const { return _it == other._it; }
+        bool operator!=(const FilterIterator & other) const { return _it != other._it; }
+
+private:
+        void skip()
+        {
+            while(_it != _end && !(*_predicate)(*_it))
+                ++_it;
+        }
+
+        Iter _it;
+        Iter _end;
+        const Predicate * _predicate;
+};
+
+/*
+ * Exposes the KdBVH interface of 'Tree', without the volumes and objects that can't match 'filter'
+ */
+template <typename Tree>
+class MaskedBVH
+{
+public:
+        enum { Dim = Tree::Dim };
+        typedef typename Tree::Scalar Scalar;
+        typedef typename Tree::Object Object;
+        typedef typename Tree::Volume Volume;
+        typedef typename Tree::Index Index;
+
+        struct VolumePredicate
+        {
+                const BVHMasks * masks;
+                MaskFilter filter;
+                bool operator()(Index index) const { return filter.may_match(masks->any[index], masks->all[index]); }
+        };
+        struct ObjectPredicate
+        {
+                const BVHMasks * masks;
+                MaskFilter filter;
+                bool operator()(const Object & object) const { return filter.matches(masks->objects[object]); }
+        };
+        typedef FilterIterator<typename Tree::VolumeIterator, VolumePredicate> VolumeIterator;
+        typedef FilterIterator<typename Tree::ObjectIterator, ObjectPredicate> ObjectIterator;
+
+        MaskedBVH(const Tree & tree, const BVHMasks & masks, const MaskFilter & filter) :
+            _tree(tree), _volume_predicate{&masks, filter}, _object_predicate{&masks, filter}
+        {
+        }
+
+        inline Index getRootIndex() const { return _tree.getRootIndex(); }
+
+        void getChildren(Index index, VolumeIterator &outVBegin, VolumeIterator &outVEnd,
+                         ObjectIterator &outOBegin, ObjectIterator &outOEnd) const
+        {
+            typename Tree::VolumeIterator vBegin = typename Tree::VolumeIterator(), vEnd = typename Tree::VolumeIterator();
+            typename Tree::ObjectIterator oBegin = typename Tree::ObjectIterator(), oEnd = typename Tree::ObjectIterator();
+            _tree.getChildren(index, vBegin, vEnd, oBegin, oEnd);
+
+            outVBegin = VolumeIterator(vBegin, vEnd, &_volume_predicate);
+            outVEnd = VolumeIterator(vEnd, vEnd, &_volume_predicate);
+            outOBegin = ObjectIterator(oBegin, oEnd, &_object_predicate);
+            outOEnd = ObjectIterator(oEnd, oEnd, &_object_predicate);
+        }
+
+        inline const Volume &getVolume(Index index) const { return _tree.getVolume(index); }
+
+private:
+        const Tree & _tree;
+        VolumePredicate _volume_predicate;
+        ObjectPredicate _object_predicate;
+};
+
+}
@@ -0,0 +1,361 @@
+/*!
+* Frame timeline profiler: scoped timers record spans (name, thread, frame, begin, end) into per-thread ring buffers.
+* Recording is lock-free (each thread only writes its own buffer, whose slots are seqlocks), and only costs an atomic load when disabled.
+* Spans can be exported to the Chrome trace event format (chrome://tracing, https://ui.perfetto.dev)
+* or aggregated per frame (p50, p99).
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Eigen
+{
+namespace profiling
+{
+
+/*
+ * \return a monotonic timestamp, in nanoseconds
+ */
+inline int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Span
+{
+        uint32_t name;
+        uint32_t thread;
+        uint64_t frame;
+        int64_t begin; //ns
+        int64_t end; //ns
+};
+
+/*
+ * durations are in milliseconds
+ */
+struct FrameStats
+{
+        size_t n_frames; //frames in which the span occurred
+        size_t n_spans;
+        double p50;
+        double p99;
+        double max;
+};
+
+class Profiler
+{
+public:
+        static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+        static Profiler & instance()
+        {
+            static Profiler profiler;
+            return profiler;
+        }
+
+        bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+        /*
+         * 'capacity' is the number of spans each thread's ring buffer keeps, it only applies to threads that did not record yet
+         */
+        void enable(bool enabled = true, size_t capacity = DEFAULT_CAPACITY)
+        {
+            _capacity.store(std::max<size_t>(capacity, 1));
+            _enabled.store(enabled);
+        }
+
+        /*
+         * \return the id of 'name', to be passed to record() and ScopedTimer (ids are cached, call intern() once per name)
+         */
+        uint32_t intern(const std::string & name)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _ids.find(name);
+            if(it != _ids.end())
+                return it->second;
+            _names.push_back(name);
+            return _ids[name] = uint32_t(_names.size() - 1);
+        }
+
+        void record(uint32_t name, int64_t begin, int64_t end)
+        {
+            record(name, begin, end, _frame.load(std::memory_order_relaxed));
+        }
+
+        void record(uint32_t name, int64_t begin, int64_t end, uint64_t frame)
+        {
+            if(!enabled())
+                return;
+            ThreadBuffer & buffer = thread_buffer();
+            const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+            buffer.write(head, Span{name, buffer.id, frame, begin, end});
+            buffer.head.store(head + 1, std::memory_order_release);
+        }
+
+        /*
+         * starts a new frame, and records the previous one as a "frame" span. \return the new frame's number
+         */
+        uint64_t begin_frame()
+        {
+            const int64_t t = now();
+            const int64_t previous = _frame_begin.exchange(t);
+            const uint64_t frame = _frame.fetch_add(1);
+            if(previous > 0)
+                record(_frame_name, previous, t, frame);
+            return frame + 1;
+        }
+
+        uint64_t frame() const { return _frame.load(); }
+
+        /*
+         * forgets spans recorded so far (buffers are not freed, their owner threads keep writing to them)
+         */
+        void clear()
+        {
+            _cleared_at.store(now());
+            _frame_begin.store(0);
+        }
+
+        /*
+         * \return a snapshot of all threads' spans, sorted by begin time. Threads keep recording meanwhile:
+         * spans overwritten before or while they were copied are dropped
+         */
+        std::vector<Span> spans() const
+        {
+            std::vector<Span> spans;
+            const int64_t cleared_at = _cleared_at.load();
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            for(const auto & buffer : _buffers)
+            {
+                const uint64_t capacity = buffer->slots.size();
+                const uint64_t head = buffer->head.load(std::memory_order_acquire);
+                const uint64_t first = head > capacity ? head - capacity : 0;
+
+                Span span;
+                for(uint64_t i = first; i < head; i++)
+                    if(buffer->read(i, span) && span.begin >= cleared_at)
+                        spans.push_back(span);
+            }
+
+            std::sort(spans.begin(), spans.end(), [](const Span & lhs, const Span & rhs){ return lhs.begin < rhs.begin; });
+            return spans;
+        }
+
+        std::string name(uint32_t id) const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return id < _names.size() ? _names[id] : std::string();
+        }
+
+        /*
+         * \return spans in the Chrome trace event format (complete events, timestamps in microseconds)
+         */
+        std::string chrome_trace() const
+        {
+            const std::vector<Span> all = spans();
+            const std::vector<std::string> names = all_names();
+
+            std::ostringstream json;
+            json << std::fixed << std::setprecision(3);
+            json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+            for(size_t i = 0; i < all.size(); i++)
+            {
+                const Span & s = all[i];
+                json << (i ? ",\n" : "\n")
+                     << "{\"name\":\"" << escape(names[s.name]) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << s.thread
+                     << ",\"ts\":" << s.begin * 1e-3 << ",\"dur\":" << (s.end - s.begin) * 1e-3
+                     << ",\"args\":{\"frame\":" << s.frame << "}}";
+            }
+            json << "\n]}";
+            return json.str();
+        }
+
+        /*
+         * \return for each span name, percentiles of its total duration per frame
+         */
+        std::map<std::string, FrameStats> frame_stats() const
+        {
+            const std::vector<Span> all = spans();
+            const std::vector<std::string> names = all_names();
+
+            std::map<uint32_t, std::map<uint64_t, int64_t>> per_frame; //name -> frame -> total duration
+            std::map<uint32_t, size_t> n_spans;
+            for(const Span & s : all)
+            {
+                per_frame[s.name][s.frame] += s.end - s.begin;
+                n_spans[s.name]++;
+            }
+
+            std::map<std::string, FrameStats> stats;
+            for(const auto & frames : per_frame)
+            {
+                std::vector<double> durations;
+                durations.reserve(frames.second.size());
+                for(const auto & frame : frames.second)
+                    durations.push_back(frame.second * 1e-6);
+                std::sort(durations.begin(), durations.end());
+
+                stats[names[frames.first]] = FrameStats{durations.size(), n_spans[frames.first]
+                    , percentile(durations, .5), percentile(durations, .99), durations.back()};
+            }
+            return stats;
+        }
+
+private:
+        /*
+         * A span slot, guarded by a seqlock: while the span of index i is written, 'sequence' is odd,
+         * then it is 2 * (i + 1). Fields are relaxed atomics, so that concurrent copies are not data races
+         */
+        struct Slot
+        {
+                Slot() : sequence(0), name(0), thread(0), frame(0), begin(0), end(0) {}
+
+                std::atomic<uint64_t> sequence;
+                std::atomic<uint32_t> name;
+                std::atomic<uint32_t> thread;
+                std::atomic<uint64_t> frame;
+                std::atomic<int64_t> begin;
+                std::atomic<int64_t> end;
+        };
+
+        struct ThreadBuffer
+        {
+                ThreadBuffer(uint32_t id, size_t capacity) : slots(capacity), head(0), id(id) {}
+
+                /*
+                 * only called by the owner thread
+                 */
+                void write(uint64_t index, const Span & span)
+                {
+                    Slot & slot = slots[index % slots.size()];
+                    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release); //orders the odd sequence before the fields
+                    slot.name.store(span.name, std::memory_order_relaxed);
+                    slot.thread.store(span.thread, std::memory_order_relaxed);
+                    slot.frame.store(span.frame, std::memory_order_relaxed);
+                    slot.begin.store(span.begin, std::memory_order_relaxed);
+                    slot.end.store(span.end, std::memory_order_relaxed);
+                    slot.sequence.store(2 * index + 2, std::memory_order_release);
+                }
+
+                /*
+                 * \return false if the slot did not hold the span of 'index' for the whole copy
+                 */
+                bool read(uint64_t index, Span & span) const
+                {
+                    const Slot & slot = slots[index % slots.size()];
+                    const uint64_t expected = 2 * index + 2;
+                    if(slot.sequence.load(std::memory_order_acquire) != expected)
+                        return false;
+                    span = Span{slot.name.load(std::memory_order_relaxed), slot.thread.load(std::memory_order_relaxed)
+                        , slot.frame.load(std::memory_order_relaxed), slot.begin.load(std::memory_order_relaxed), slot.end.load(std::memory_order_relaxed)};
+                    std::atomic_thread_fence(std::memory_order_acquire); //orders the copy before the recheck
+                    return slot.sequence.load(std::memory_order_relaxed) == expected;
+                }
+
+                std::vector<Slot> slots;
+                std::atomic<uint64_t> head;
+                const uint32_t id;
+        };
+
+        Profiler() : _enabled(false), _capacity(DEFAULT_CAPACITY), _frame(0), _frame_begin(0), _cleared_at(0)
+        {
+            _frame_name = intern("frame");
+        }
+
+        ThreadBuffer & thread_buffer()
+        {
+            thread_local ThreadBuffer * buffer = nullptr; //owned by _buffers, outlives the thread
+            if(!buffer)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _buffers.emplace_back(new ThreadBuffer(uint32_t(_buffers.size()), _capacity.load()));
+                buffer = _buffers.back().get();
+            }
+            return *buffer;
+        }
+
+        std::vector<std::string> all_names() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _names;
+        }
+
+        /*
+         * nearest-rank percentile of non empty 'sorted'
+         */
+        static double percentile(const std::vector<double> & sorted, double p)
+        {
+            const size_t rank = size_t(std::ceil(p * sorted.size()));
+            return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+        }
+
+        static std::string escape(const std::string & s)
+        {
+            std::string escaped;
+            for(char c : s)
+            {
+                if(c == '"' || c == '\\')
+                    escaped += '\\';
+                if(static_cast<unsigned char>(c) >= 0x20)
+                    escaped += c;
+            }
+            return escaped;
+        }
+
+        std::atomic<bool> _enabled;
+        std::atomic<size_t> _capacity;
+        std::atomic<uint64_t> _frame;
+        std::atomic<int64_t> _frame_begin;
+        std::atomic<int64_t> _cleared_at;
+        uint32_t _frame_name;
+
+        mutable std::mutex _mutex; //guards names and buffers registration, never taken when recording
+        std::vector<std::string> _names;
+        std::unordered_map<std::string, uint32_t> _ids;
+        std::vector<std::unique_ptr<ThreadBuffer>> _buffers;
+};
+
+inline uint32_t intern(const std::string & name) { return Profiler::instance().intern(name); }
+
+/*
+ * records a span from its construction to its destruction, e.g.:
+ *      static const uint32_t span = profiling::intern("bvh.build");
+ *      profiling::ScopedTimer timer(span);
+ */
+class ScopedTimer
+{
+public:
+        explicit ScopedTimer(uint32_t name) : _name(name), _begin(Profiler::instance().enabled() ? now() : 0) {}
+
+        ~ScopedTimer()
+        {
+            if(_begin != 0)
+                Profiler::instance().record(_name, _begin, now());
+        }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer & operator=(const ScopedTimer &) = delete;
+
+private:
+        const uint32_t _name;
+        const int64_t _begin;
+};
+
+}
+}
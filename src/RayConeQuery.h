@@ -0,0 +1,268 @@
+/*!
+* Thick ray query for the needs of Eigen::BVIntersect: finds the objects within a cone of radius
+* 'radius' at the ray's origin, growing by 'slope' per unit of distance along the ray (a capsule if
+* 'slope' is zero). Meant for tolerance picking, where a tolerance in pixels grows with the distance
+* from the camera.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include "traits.h"
+#include <Eigen/Dense>
+#include "line_intersections.h"
+#include "line_distances.h"
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace Eigen
+{
+
+template <typename BVH, typename BVHWrapper>
+struct RayConeQuery
+{
+        static constexpr size_t Dim = BVHWrapper::Dim;
+        typedef typename BVHWrapper::Point Point;
+        typedef typename BVHWrapper::ShapeIndices Shape;
+        typedef scalar_t<Point> Scalar;
+
+        /*
+         * distance: from the ray to the object (0 if the ray intersects it)
+         * tuv: t along the ray (in 'direction' units) of the closest point, and its barycentric coordinates for triangles.
+         * If the closest point lies outside the cone (e.g. behind the origin, or too close to it where the cone is narrower),
+         * the object's point found deepest in the cone instead
+         */
+        struct Hit
+        {
+                typename BVH::Object id;
+                Scalar distance;
+                Point tuv;
+        };
+        typedef std::vector<Hit> Hits;
+
+        /*
+         * \return hits sorted by t, then by distance, each object once (spatial split trees may reference an object from several leaves)
+         */
+        const Hits & sorted()
+        {
+            std::sort(hits.begin(), hits.end(), [](const Hit & lhs, const Hit & rhs)
+            {
+                return lhs.tuv[0] < rhs.tuv[0] || (lhs.tuv[0] == rhs.tuv[0] && (lhs.distance < rhs.distance
+                        || (lhs.distance == rhs.distance && lhs.id < rhs.id)));
+            });
+            hits.erase(std::unique(hits.begin(), hits.end(), [](const Hit & lhs, const Hit & rhs){ return lhs.id == rhs.id; }), hits.end());
+            return hits;
+        }
+
+        const BVHWrapper & wrapper;
+        const Point origin;
+        Point unit_direction;
+        Scalar direction_norm;
+        Point inv_direction;
+        std::array<unsigned, Dim> signs;
+        const Scalar radius;
+        const Scalar slope;
+        const bool keep_closest_only;
+        Scalar t_max; // along 'unit_direction', shrinks as hits are found if 'keep_closest_only'
+
+        //results:
+        Hits hits;
+
+        RayConeQuery(const BVHWrapper & wrapper, const Point & origin, const Point & direction, Scalar radius, Scalar slope = 0, bool keep_closest_only = false) :
+            wrapper(wrapper), origin(origin), radius(radius), slope(slope), keep_closest_only(keep_closest_only)
+            , t_max(std::numeric_limits<Scalar>::max())
+        {
+            direction_norm = direction.norm();
+            unit_direction = direction / direction_norm;
+            intersections::signs_and_inv_direction(unit_direction, signs, inv_direction);
+        }
+
+        Scalar radius_at(Scalar t) const { return radius + slope * t; }
+
+        /*
+         * conservative: the cone is bounded by the cylinder of its radius at the box's farthest point along the ray
+         */
+        bool intersectBox(const Point & min, const Point & max) const
+        {
+            const Point half_sizes = (max - min) / 2;
+            const Scalar t_far = (min + half_sizes - origin).dot(unit_direction) + half_sizes.dot(unit_direction.cwiseAbs());
+            if(t_far < 0)
+                return false;
+
+            const Scalar r = radius_at(std::min(t_far, t_max));
+            Scalar p_min, p_max;
+            return intersections::intersect_line_box<Point>(origin, inv_direction, signs
+                    , (min.array() - r).matrix(), (max.array() + r).matrix(), Scalar(0), t_max, p_min, p_max);
+        }
+
+        bool intersectVolume(const typename BVH::Volume &volume)
+        {
+            return intersectBox(volume.min().transpose(), volume.max().transpose());
+        }
+
+        bool intersectObject(const typename BVH::Object &object)
+        {
+            const auto & box = wrapper.boxes_begin()[object];
+            if(!intersectBox(box.min().transpose(), box.max().transpose()))
+                return false;
+
+            Scalar distance;
+            Point tuv;
+            const auto is_triangle = std::integral_constant<bool, (BVHWrapper::ShapeDim > 1)>();
+            closest(wrapper.indices(object), distance, tuv, is_triangle);
+
+            if((tuv[0] >= 0 && tuv[0] <= t_max && distance <= radius_at(tuv[0]))
+               || in_cone(wrapper.indices(object), distance, tuv, is_triangle))
+            {
+                if(keep_closest_only)
+                    t_max = tuv[0];
+                tuv[0] /= direction_norm;
+                hits.emplace_back(Hit{object, distance, tuv});
+            }
+            return false; //never stop query
+        }
+
+private:
+        /*
+         * a triangle's point, and its barycentric coordinates
+         */
+        struct Vertex
+        {
+                Point p;
+                Scalar u, v;
+        };
+
+        /*
+         * t along the ray and squared distance to the ray of 'p'
+         */
+        void project(const Point & p, Scalar & t, Scalar & squared_distance) const
+        {
+            const Point w = p - origin;
+            t = w.dot(unit_direction);
+            squared_distance = (w - t * unit_direction).squaredNorm();
+        }
+
+        /*
+         * the cone contains 'p' if g(p) = radius_at(t)^2 - distance^2 >= 0, t >= 0
+         */
+        Scalar g(const Vertex & vertex, Scalar & t, Scalar & squared_distance) const
+        {
+            project(vertex.p, t, squared_distance);
+            const Scalar r = radius_at(t);
+            return r * r - squared_distance;
+        }
+
+        /*
+         * keeps 'polygon''s part where t >= 0 (Sutherland-Hodgman), 'ts' being its vertices' t, \return the new size
+         */
+        static size_t clip(const std::array<Vertex, 4> & polygon, size_t size, const std::array<Scalar, 4> & ts, std::array<Vertex, 4> & clipped)
+        {
+            size_t n = 0;
+            for(size_t i = 0; i < size; i++)
+            {
+                const size_t j = (i + 1) % size;
+                const Scalar di = ts[i], dj = ts[j];
+                if(di >= 0)
+                    clipped[n++] = polygon[i];
+                if((di < 0) != (dj < 0))
+                {
+                    const Scalar a = di / (di - dj);
+                    clipped[n++] = Vertex{polygon[i].p + a * (polygon[j].p - polygon[i].p)
+                        , polygon[i].u + a * (polygon[j].u - polygon[i].u), polygon[i].v + a * (polygon[j].v - polygon[i].v)};
+                }
+            }
+            return n;
+        }
+
+        /*
+         * exact test, for triangles whose closest point to the ray is not in the cone: the triangle, clipped to t >= 0,
+         * intersects the cone if one of its edges does (else the cone's section would be inside the triangle, and so would the ray's point
+         * closest to the triangle). g is quadratic along an edge, so its maximum is found in closed form.
+         * The point reported does not depend on t_max, so that 'keep_closest_only' keeps the first of all hits
+         */
+        bool in_cone(const Shape & triangle, Scalar & distance, Point & tuv, std::true_type) const
+        {
+            std::array<Vertex, 4> polygon, clipped;
+            std::array<Scalar, 4> ts;
+            polygon[0] = Vertex{wrapper.point(triangle[0]), 0, 0};
+            polygon[1] = Vertex{wrapper.point(triangle[1]), 1, 0};
+            polygon[2] = Vertex{wrapper.point(triangle[2]), 0, 1};
+            size_t size = 3;
+
+            Scalar unused;
+            for(size_t i = 0; i < size; i++)
+                project(polygon[i].p, ts[i], unused);
+            size = clip(polygon, size, ts, clipped);
+
+            Scalar best_g = -1, best_t = 0, best_squared_distance = 0;
+            Vertex best{Point::Zero(), 0, 0};
+            auto update = [&](const Vertex & vertex)
+            {
+                Scalar t, squared_distance;
+                const Scalar value = g(vertex, t, squared_distance);
+                if(value >= 0 && value > best_g)
+                {
+                    best_g = value;
+                    best_t = t;
+                    best_squared_distance = squared_distance;
+                    best = vertex;
+                }
+            };
+
+            for(size_t i = 0; i < size; i++)
+            {
+                const Vertex & a = clipped[i];
+                const Vertex & b = clipped[(i + 1) % size];
+                update(a);
+
+                // along the edge, t(l) = t_a + l * t_e, and the vector from the ray is q_a + l * q_e
+                Scalar t_a, unused_squared;
+                project(a.p, t_a, unused_squared);
+                const Point e = b.p - a.p;
+                const Scalar t_e = e.dot(unit_direction);
+                const Point q_a = (a.p - origin) - t_a * unit_direction;
+                const Point q_e = e - t_e * unit_direction;
+                const Scalar A = slope * slope * t_e * t_e - q_e.squaredNorm();
+                const Scalar B = 2 * (slope * t_e * radius_at(t_a) - q_a.dot(q_e));
+                if(A < 0)
+                {
+                    const Scalar l = -B / (2 * A);
+                    if(l > 0 && l < 1)
+                        update(Vertex{a.p + l * e, a.u + l * (b.u - a.u), a.v + l * (b.v - a.v)});
+                }
+            }
+
+            if(best_g < 0 || best_t > t_max)
+                return false;
+
+            distance = std::sqrt(best_squared_distance);
+            tuv = Point(best_t, best.u, best.v);
+            return true;
+        }
+
+        bool in_cone(const Shape &, Scalar &, Point &, std::false_type) const
+        {
+            return false; //a point is its own closest point
+        }
+
+        void closest(const Shape & triangle, Scalar & distance, Point & tuv, std::true_type) const
+        {
+            Matrix<Scalar, Dim, 1> column_tuv;
+            std::tie(distance, column_tuv) = distances::line_triangle_distance(origin.transpose().eval()
+                    , unit_direction.transpose().eval()
+                    , wrapper.point(triangle[0]).transpose().eval()
+                    , wrapper.point(triangle[1]).transpose().eval()
+                    , wrapper.point(triangle[2]).transpose().eval());
+            tuv = column_tuv.transpose();
+        }
+
+        void closest(const Shape & point, Scalar & distance, Point & tuv, std::false_type) const
+        {
+            tuv = Point::Zero();
+            distance = distances::line_point_distance(origin, unit_direction, Point(wrapper.point(point[0])), tuv[0]);
+        }
+};
+}
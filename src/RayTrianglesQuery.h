@@ -9,6 +9,7 @@
 #include <Eigen/Dense>
 #include "line_intersections.h"
 #include "line_distances.h"
+#include <algorithm>
 #include <vector>
 #include <array>
 #include <numeric>
@@ -36,9 +37,17 @@ struct RayTrianglesQuery
         };
         typedef std::vector<Intersection> Intersections;
 
+        /*
+         * \return intersections sorted by t, each triangle once (spatial split trees may reference a triangle from several leaves)
+         */
         const std::vector<Intersection> & sorted()
         {
-            std::sort(intersections.begin(), intersections.end(), [](const auto & lhs, const auto & rhs){return lhs.tuv[0] < rhs.tuv[0];});
+            std::sort(intersections.begin(), intersections.end(), [](const auto & lhs, const auto & rhs)
+            {
+                return lhs.tuv[0] < rhs.tuv[0] || (lhs.tuv[0] == rhs.tuv[0] && lhs.id < rhs.id);
+            });
+            intersections.erase(std::unique(intersections.begin(), intersections.end(), [](const auto & lhs, const auto & rhs){return lhs.id == rhs.id;})
+                    , intersections.end());
             return intersections;
         }
 
@@ -108,4 +117,60 @@ struct RayTrianglesQuery
 
         }
 };
+
+/*
+ * Closest intersection in [0, t_max] along the ray, farther volumes being pruned as closer intersections are found
+ */
+template <typename BVH, typename BVHWrapper>
+struct RayClosestTriangleQuery
+{
+        static constexpr size_t Dim = BVHWrapper::Dim;
+        typedef typename BVHWrapper::Point Point;
+        typedef typename BVHWrapper::ShapeIndices Triangle;
+        typedef scalar_t<Point> Scalar;
+
+        const BVHWrapper & wrapper;
+        const Point origin;
+        const Point direction;
+        Point inv_direction;
+        std::array<unsigned, Dim> signs;
+
+        //results:
+        bool hit;
+        typename BVH::Object id;
+        Point tuv; //tuv[0] is t_max until an intersection is found
+
+        RayClosestTriangleQuery(const BVHWrapper & wrapper, const Point & origin, const Point & direction, Scalar t_max = std::numeric_limits<Scalar>::max()) :
+            wrapper(wrapper), origin(origin), direction(direction), hit(false), id(~0u)
+        {
+            intersections::signs_and_inv_direction(direction, signs, inv_direction);
+            tuv = Point::Zero();
+            tuv[0] = t_max;
+        }
+
+        bool intersectVolume(const typename BVH::Volume &volume)
+        {
+            Scalar p_min, p_max;
+            return intersections::intersect_line_box<Point>(origin, inv_direction, signs, volume.min(), volume.max(), Scalar(0), tuv[0], p_min, p_max);
+        }
+
+        bool intersectObject(const typename BVH::Object &object)
+        {
+            Triangle t = wrapper.indices(object);
+            Point object_tuv;
+            if(intersections::intersect_line_triangle<false>(origin
+                    , direction
+                    , wrapper.point(t[0])
+                    , wrapper.point(t[1])
+                    , wrapper.point(t[2])
+                    , object_tuv)
+               && object_tuv[0] >= 0 && object_tuv[0] < tuv[0])
+            {
+                hit = true;
+                id = object;
+                tuv = object_tuv;
+            }
+            return false; //never stop query
+        }
+};
 }
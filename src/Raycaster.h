@@ -0,0 +1,338 @@
+/*!
+* Headless renderer: casts one ray per pixel through the view and projection matrices against instances
+* of triangle and point hierarchies, and produces depth, normal, (instance, primitive) ids and flat shaded
+* color images. Images are rendered by tiles, in parallel. Rendering may be progressive: render(8),
+* render(4), render(2), render(1) only traces the pixels that were not traced at the previous (coarser) steps.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <unsupported/Eigen/BVH>
+#include "BVHTree.h"
+#include "RayTrianglesQuery.h"
+#include "RayConeQuery.h"
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace Eigen
+{
+
+template <typename TrianglesWrapper, typename PointsWrapper>
+class Raycaster
+{
+public:
+        typedef typename TrianglesWrapper::Box::Scalar Scalar;
+        typedef Matrix<Scalar, 4, 4> Matrix4;
+        typedef Matrix<Scalar, 3, 1> Vector3;
+        typedef Matrix<Scalar, 4, 1> Color;
+        typedef BVHTree<TrianglesWrapper> TrianglesTree;
+        typedef BVHTree<PointsWrapper> PointsTree;
+
+        typedef Matrix<Scalar, Dynamic, Dynamic, RowMajor> Depths;
+        typedef Matrix<Scalar, Dynamic, 3, RowMajor> Normals;
+        typedef Matrix<int, Dynamic, 2, RowMajor> Ids;
+        typedef Matrix<uint8_t, Dynamic, 4, RowMajor> Colors;
+
+        static constexpr int TILE_SIZE = 32;
+
+        struct Stats
+        {
+                size_t n_rays;
+                double seconds;
+                double mrays_per_s() const { return seconds > 0 ? n_rays / seconds * 1e-6 : 0; }
+        };
+
+        Raycaster(int width, int height) : ambient(0.2f), background(Color::Zero()), _width(width), _height(height)
+        {
+            if(width <= 0 || height <= 0)
+                throw std::invalid_argument("image size must be positive");
+
+            set_camera(Matrix4::Identity(), Matrix4::Identity());
+            _depths.resize(height, width);
+            _normals.resize(size_t(width) * height, 3);
+            _ids.resize(size_t(width) * height, 2);
+            _colors.resize(size_t(width) * height, 4);
+        }
+
+        /*
+         * OpenGL view and projection matrices (e.g. Camera.view_matrix() and Viewport.perspective_matrix())
+         */
+        void set_camera(const Matrix4 & view, const Matrix4 & projection)
+        {
+            _view = view;
+            _inv_view_projection = (projection * view).inverse();
+
+            //a pixel's footprint on the near and far planes, for points' size
+            Vector3 o0, d0, o1, d1;
+            pixel_ray(_width / 2, _height / 2, o0, d0);
+            pixel_ray(_width / 2 + 1, _height / 2, o1, d1);
+            _pixel_radius = (o1 - o0).norm() / 2;
+            _pixel_slope = (((o1 + d1) - (o0 + d0)).norm() / 2 - _pixel_radius) / d0.norm();
+            invalidate();
+        }
+
+        void add_triangles(const TrianglesTree & tree, const TrianglesWrapper & wrapper, const Matrix4 & model, const Color & color)
+        {
+            _triangles.emplace_back(TrianglesInstance{Instance(model, color), &tree, &wrapper});
+            invalidate();
+        }
+
+        /*
+         * \param point_size in pixels
+         */
+        void add_points(const PointsTree & tree, const PointsWrapper & wrapper, const Matrix4 & model, const Color & color, Scalar point_size = 1)
+        {
+            _points.emplace_back(PointsInstance{Instance(model, color), &tree, &wrapper, point_size});
+            invalidate();
+        }
+
+        void clear()
+        {
+            _triangles.clear();
+            _points.clear();
+            invalidate();
+        }
+
+        /*
+         * forces the next render() to retrace all pixels
+         */
+        void invalidate() { _traced_step = 0; }
+
+        /*
+         * traces the pixels on a grid of spacing 'step' (a power of 2) that were not traced yet, untraced pixels
+         * being filled with their grid pixel's values
+         */
+        Stats render(int step = 1)
+        {
+            if(step <= 0 || (step & (step - 1)) != 0)
+                throw std::invalid_argument("step must be a power of 2");
+
+            const auto start = std::chrono::steady_clock::now();
+            const int traced = _traced_step;
+            if(traced != 0 && step >= traced)
+                return Stats{0, 0};
+
+            auto is_traced = [&](int x, int y){ return traced != 0 && x % traced == 0 && y % traced == 0; };
+
+            const int n_tiles_x = (_width + TILE_SIZE - 1) / TILE_SIZE, n_tiles_y = (_height + TILE_SIZE - 1) / TILE_SIZE;
+            std::atomic<size_t> n_rays(0);
+            tbb::parallel_for(tbb::blocked_range2d<int>(0, n_tiles_y, 1, 0, n_tiles_x, 1), [&](const tbb::blocked_range2d<int> & tiles)
+            {
+                size_t tile_rays = 0;
+                for(int ty = tiles.rows().begin(); ty != tiles.rows().end(); ty++)
+                    for(int tx = tiles.cols().begin(); tx != tiles.cols().end(); tx++)
+                        for(int y = ty * TILE_SIZE; y < std::min(_height, (ty + 1) * TILE_SIZE); y++)
+                        {
+                            if(y % step != 0)
+                                continue;
+                            for(int x = tx * TILE_SIZE; x < std::min(_width, (tx + 1) * TILE_SIZE); x++)
+                            {
+                                if(x % step != 0 || is_traced(x, y))
+                                    continue;
+                                trace(x, y);
+                                tile_rays++;
+                            }
+                        }
+                n_rays += tile_rays;
+            });
+
+            if(step > 1)
+            {
+                tbb::parallel_for(0, _height, [&](int y)
+                {
+                    for(int x = 0; x < _width; x++)
+                        if(x % step != 0 || y % step != 0)
+                            copy_pixel(x - x % step, y - y % step, x, y);
+                });
+            }
+            _traced_step = step;
+
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return Stats{n_rays.load(), seconds};
+        }
+
+        int width() const { return _width; }
+        int height() const { return _height; }
+
+        /*
+         * eye space depth, +inf where nothing was hit
+         */
+        const Depths & depths() const { return _depths; }
+
+        /*
+         * world space normals, facing the camera, one row per pixel
+         */
+        const Normals & normals() const { return _normals; }
+
+        /*
+         * (instance, primitive) ids, (-1, -1) where nothing was hit, one row per pixel. Triangles instances come first, then points instances
+         */
+        const Ids & ids() const { return _ids; }
+
+        /*
+         * RGBA, one row per pixel
+         */
+        const Colors & colors() const { return _colors; }
+
+        Scalar ambient;
+        Color background;
+
+private:
+        struct Instance
+        {
+                Instance(const Matrix4 & model, const Color & color) : color(color)
+                {
+                    Transform<Scalar, 3, Affine> m(model);
+                    inv_model = m.inverse();
+                    normal_matrix = m.linear().inverse().transpose();
+                }
+                Transform<Scalar, 3, Affine> inv_model;
+                Matrix<Scalar, 3, 3> normal_matrix;
+                Color color;
+        };
+        struct TrianglesInstance
+        {
+                Instance instance;
+                const TrianglesTree * tree;
+                const TrianglesWrapper * wrapper;
+        };
+        struct PointsInstance
+        {
+                Instance instance;
+                const PointsTree * tree;
+                const PointsWrapper * wrapper;
+                Scalar point_size;
+        };
+
+        /*
+         * ray from the near plane (t = 0) to the far plane (t = 1) through pixel (x, y)'s center
+         */
+        void pixel_ray(int x, int y, Vector3 & origin, Vector3 & direction) const
+        {
+            const Scalar ndc_x = (x + Scalar(0.5)) / _width * 2 - 1;
+            const Scalar ndc_y = 1 - (y + Scalar(0.5)) / _height * 2;
+            const Matrix<Scalar, 4, 1> near = _inv_view_projection * Matrix<Scalar, 4, 1>(ndc_x, ndc_y, -1, 1);
+            const Matrix<Scalar, 4, 1> far = _inv_view_projection * Matrix<Scalar, 4, 1>(ndc_x, ndc_y, 1, 1);
+            origin = near.template head<3>() / near[3];
+            direction = far.template head<3>() / far[3] - origin;
+        }
+
+        void trace(int x, int y)
+        {
+            Vector3 origin, direction;
+            pixel_ray(x, y, origin, direction);
+
+            Scalar t = 1;
+            int instance = -1, id = -1;
+            Vector3 normal = Vector3::Zero();
+
+            for(size_t i = 0; i < _triangles.size(); i++)
+            {
+                const TrianglesInstance & triangles = _triangles[i];
+                typedef RayClosestTriangleQuery<typename TrianglesTree::KdTree, TrianglesWrapper> Query;
+                Query query(*triangles.wrapper
+                        , (triangles.instance.inv_model * origin).transpose()
+                        , (triangles.instance.inv_model.linear() * direction).transpose(), t);
+                triangles.tree->visit([&](const auto & tree){BVIntersect(tree, query);});
+                if(query.hit)
+                {
+                    t = query.tuv[0];
+                    instance = int(i);
+                    id = int(query.id);
+                    auto indices = triangles.wrapper->indices(query.id);
+                    const Vector3 v0 = triangles.wrapper->point(indices[0]).transpose();
+                    const Vector3 v1 = triangles.wrapper->point(indices[1]).transpose();
+                    const Vector3 v2 = triangles.wrapper->point(indices[2]).transpose();
+                    normal = triangles.instance.normal_matrix * (v1 - v0).cross(v2 - v0);
+                }
+            }
+
+            for(size_t i = 0; i < _points.size(); i++)
+            {
+                const PointsInstance & points = _points[i];
+                typedef RayConeQuery<typename PointsTree::KdTree, PointsWrapper> Query;
+                Query query(*points.wrapper
+                        , (points.instance.inv_model * origin).transpose()
+                        , (points.instance.inv_model.linear() * direction).transpose()
+                        , _pixel_radius * points.point_size, _pixel_slope * points.point_size, true);
+                query.t_max = t * query.direction_norm;
+                points.tree->visit([&](const auto & tree){BVIntersect(tree, query);});
+                if(!query.hits.empty())
+                {
+                    const auto & hit = query.sorted().front();
+                    t = hit.tuv[0];
+                    instance = int(_triangles.size() + i);
+                    id = int(hit.id);
+                    normal = -direction;
+                }
+            }
+
+            const size_t pixel = size_t(y) * _width + x;
+            _ids(pixel, 0) = instance;
+            _ids(pixel, 1) = id;
+            if(instance < 0)
+            {
+                _depths(y, x) = std::numeric_limits<Scalar>::infinity();
+                _normals.row(pixel).setZero();
+                _colors.row(pixel) = to_rgba8(background);
+                return;
+            }
+
+            const Vector3 unit_direction = direction.normalized();
+            normal.normalize();
+            if(normal.dot(unit_direction) > 0)
+                normal = -normal;
+
+            const Color & color = instance < int(_triangles.size()) ? _triangles[instance].instance.color : _points[instance - _triangles.size()].instance.color;
+            const Scalar shade = ambient + (1 - ambient) * std::fabs(normal.dot(unit_direction));
+            Color shaded = color;
+            shaded.template head<3>() *= shade;
+
+            _depths(y, x) = -(_view * (origin + t * direction).homogeneous())[2];
+            _normals.row(pixel) = normal.transpose();
+            _colors.row(pixel) = to_rgba8(shaded);
+        }
+
+        static Matrix<uint8_t, 1, 4> to_rgba8(const Color & color)
+        {
+            return (color.cwiseMax(Scalar(0)).cwiseMin(Scalar(1)) * 255 + Color::Constant(Scalar(0.5))).template cast<uint8_t>().transpose();
+        }
+
+        void copy_pixel(int from_x, int from_y, int x, int y)
+        {
+            const size_t from = size_t(from_y) * _width + from_x, to = size_t(y) * _width + x;
+            _depths(y, x) = _depths(from_y, from_x);
+            _normals.row(to) = _normals.row(from);
+            _ids.row(to) = _ids.row(from);
+            _colors.row(to) = _colors.row(from);
+        }
+
+        const int _width;
+        const int _height;
+        Matrix4 _view;
+        Matrix4 _inv_view_projection;
+        Scalar _pixel_radius;
+        Scalar _pixel_slope;
+        int _traced_step; //finest step traced since the last change, 0 if none
+
+        std::vector<TrianglesInstance> _triangles;
+        std::vector<PointsInstance> _points;
+
+        Depths _depths;
+        Normals _normals;
+        Ids _ids;
+        Colors _colors;
+};
+
+}
@@ -0,0 +1,441 @@
+/*!
+* Spatial split BVH (SBVH) builder for FlatBVH, as described in
+* Stich, Friedrich and Dietrich, "Spatial Splits in Bounding Volume Hierarchies", HPG 2009.
+* Nodes are split top-down with the binned surface area heuristic, either by partitioning objects (object split),
+* or, where object splits' children overlap, by splitting space: objects straddling the plane are then referenced
+* by both children, each reference being clipped to its child's side.
+* Long, thin or overlapping objects get much tighter volumes, at the cost of a slower build and duplicate references,
+* which are capped by 'max_duplication'. Queries reporting all objects must ignore duplicates.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include "FlatBVH.h"
+#include <tbb/parallel_invoke.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace Eigen
+{
+
+template <typename Tree, typename BVHWrapper>
+class SpatialSplitBVHBuilder
+{
+public:
+        typedef typename Tree::Scalar Scalar;
+        typedef typename Tree::Volume Volume;
+        typedef typename Tree::Object Object;
+        typedef typename Tree::Node Node;
+        typedef Matrix<Scalar, Tree::Dim, 1> Vector;
+
+        static constexpr int N_BINS = 32;
+        static constexpr Scalar NODE_COST = Scalar(1.2);
+        static constexpr Scalar OBJECT_COST = Scalar(1);
+        static constexpr Scalar MIN_OVERLAP = Scalar(1e-5); //spatial splits are only tried where object splits' children overlap more (relative to the root's area)
+        static constexpr size_t PARALLEL_REFERENCES = 4096; //smaller subtrees are built serially
+
+        /*
+         * 'max_duplication': the number of references may grow up to (1 + max_duplication) times the number of objects
+         */
+        SpatialSplitBVHBuilder(Tree & tree, const BVHWrapper & wrapper, Scalar max_duplication = Scalar(2)) :
+            _tree(tree), _wrapper(wrapper), _max_duplication(std::max(max_duplication, Scalar(0)))
+        {
+        }
+
+        template <typename OIter, typename BIter>
+        void build(OIter begin, OIter end, BIter boxes_begin, BIter boxes_end)
+        {
+            const size_t n = std::distance(begin, end);
+            if(size_t(std::distance(boxes_begin, boxes_end)) != n)
+                throw std::invalid_argument("expected one box per object");
+            _tree.reset(n);
+            if(n < 2)
+            {
+                _tree.objects.assign(begin, end);
+                return;
+            }
+
+            References references(n);
+            Volume bounds;
+            for(size_t i = 0; i < n; i++)
+            {
+                references[i] = Reference{*(begin + i), *(boxes_begin + i)};
+                bounds.extend(references[i].box);
+            }
+
+            const size_t max_references = n + size_t(_max_duplication * n);
+            _root_area = area(bounds);
+
+            //at most max_references - 1 internal nodes, trimmed once built
+            _tree.nodes.resize(max_references - 1);
+            _tree.boxes.resize(max_references - 1);
+            _tree.nodes[0].parent = -1;
+            _n_nodes.store(1);
+
+            build(0, std::move(references), bounds, max_references - n);
+
+            _tree.nodes.resize(_n_nodes.load());
+            _tree.boxes.resize(_n_nodes.load());
+        }
+
+private:
+        /*
+         * an object, or the part of it within 'box'
+         */
+        struct Reference
+        {
+                Object object;
+                Volume box;
+        };
+        typedef std::vector<Reference, aligned_allocator<Reference> > References;
+
+        struct Split
+        {
+                Scalar cost = std::numeric_limits<Scalar>::max();
+                int axis = -1;
+                Scalar position = 0; //spatial splits
+                int bin = 0; //object splits: centroids in bins [0, bin) go left
+                bool spatial = false;
+                Volume left, right;
+                size_t n_left = 0, n_right = 0;
+        };
+
+        struct Bin
+        {
+                Volume box;
+                size_t count = 0; //object splits: references, spatial splits: references entering the bin
+                size_t exits = 0; //spatial splits: references leaving the bin
+        };
+
+        static Scalar area(const Volume & box)
+        {
+            if(box.isEmpty())
+                return 0;
+            auto e = box.sizes();
+            return 2 * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+        }
+
+        /*
+         * 'budget': the number of references this subtree may duplicate. What a split does not use is shared
+         * by its children in proportion to their references, so that the first subtrees built don't starve the others
+         */
+        void build(int node, References references, const Volume & bounds, size_t budget)
+        {
+            _tree.boxes[node] = bounds;
+
+            References sides[2];
+            Volume side_bounds[2];
+            const size_t n_references = references.size();
+            split(references, bounds, budget, sides, side_bounds);
+            References().swap(references);
+
+            const size_t n_sides = sides[0].size() + sides[1].size();
+            budget -= n_sides - n_references;
+            const size_t left_budget = budget * sides[0].size() / n_sides;
+            const size_t budgets[2] = {left_budget, budget - left_budget};
+
+            int children[2] = {-1, -1};
+            for(int k = 0; k < 2; k++)
+            {
+                Node & n = _tree.nodes[node];
+                if(sides[k].size() == 1)
+                {
+                    n.children[k] = -1;
+                    n.objects[k] = sides[k][0].object;
+                }
+                else
+                {
+                    children[k] = _n_nodes.fetch_add(1);
+                    n.children[k] = children[k];
+                    _tree.nodes[children[k]].parent = node;
+                }
+            }
+
+            auto build_child = [&](int k)
+            {
+                if(children[k] >= 0)
+                    build(children[k], std::move(sides[k]), side_bounds[k], budgets[k]);
+            };
+
+            if(n_sides > PARALLEL_REFERENCES && children[0] >= 0 && children[1] >= 0)
+                tbb::parallel_invoke([&]{ build_child(0); }, [&]{ build_child(1); });
+            else
+            {
+                build_child(0);
+                build_child(1);
+            }
+        }
+
+        /*
+         * splits 'references' (at least 2) into two non empty sides, duplicating at most 'budget' references
+         */
+        void split(References & references, const Volume & bounds, size_t budget, References * sides, Volume * side_bounds)
+        {
+            Volume centroids;
+            for(const Reference & r : references)
+                centroids.extend(r.box.center());
+
+            Split best = object_split(references, centroids);
+
+            if(best.axis >= 0 && budget > 0 && area(best.left.intersection(best.right)) > MIN_OVERLAP * _root_area)
+            {
+                Split spatial = spatial_split(references, bounds);
+                if(spatial.cost < best.cost && spatial.n_left + spatial.n_right - references.size() <= budget)
+                    best = spatial;
+            }
+
+            if(best.axis < 0) //all centroids coincide: split in the middle
+            {
+                const size_t middle = references.size() / 2;
+                sides[0].assign(references.begin(), references.begin() + middle);
+                sides[1].assign(references.begin() + middle, references.end());
+            }
+            else if(best.spatial)
+                partition_spatial(references, best, budget, sides);
+            else
+                partition_objects(references, best, centroids, sides);
+
+            for(int k = 0; k < 2; k++)
+            {
+                side_bounds[k] = Volume();
+                for(const Reference & r : sides[k])
+                    side_bounds[k].extend(r.box);
+            }
+        }
+
+        static int bin_of(Scalar x, Scalar min, Scalar scale)
+        {
+            return std::min(N_BINS - 1, std::max(0, int((x - min) * scale)));
+        }
+
+        Split object_split(const References & references, const Volume & centroids) const
+        {
+            Split best;
+            for(int axis = 0; axis < Tree::Dim; axis++)
+            {
+                const Scalar extent = centroids.max()[axis] - centroids.min()[axis];
+                if(!(extent > 0))
+                    continue;
+                const Scalar scale = N_BINS / extent;
+
+                std::array<Bin, N_BINS> bins;
+                for(const Reference & r : references)
+                {
+                    Bin & bin = bins[bin_of(r.box.center()[axis], centroids.min()[axis], scale)];
+                    bin.box.extend(r.box);
+                    bin.count++;
+                }
+
+                sweep(bins, [&](int split, const Volume & left, size_t n_left, const Volume & right, size_t n_right, Scalar cost)
+                {
+                    if(cost < best.cost)
+                    {
+                        best.cost = cost;
+                        best.axis = axis;
+                        best.bin = split;
+                        best.spatial = false;
+                        best.left = left;
+                        best.right = right;
+                        best.n_left = n_left;
+                        best.n_right = n_right;
+                    }
+                });
+            }
+            return best;
+        }
+
+        Split spatial_split(const References & references, const Volume & bounds) const
+        {
+            Split best;
+            for(int axis = 0; axis < Tree::Dim; axis++)
+            {
+                const Scalar min = bounds.min()[axis];
+                const Scalar extent = bounds.max()[axis] - min;
+                if(!(extent > 0))
+                    continue;
+                const Scalar scale = N_BINS / extent;
+                const Scalar width = extent / N_BINS;
+
+                std::array<Bin, N_BINS> bins;
+                for(const Reference & r : references)
+                {
+                    const int first = bin_of(r.box.min()[axis], min, scale);
+                    const int last = bin_of(r.box.max()[axis], min, scale);
+
+                    //clip the reference to each bin it spans
+                    Reference rest = r;
+                    for(int b = first; b < last; b++)
+                    {
+                        Volume left, right;
+                        clip(rest, axis, min + (b + 1) * width, left, right);
+                        bins[b].box.extend(left);
+                        rest.box = right;
+                    }
+                    bins[last].box.extend(rest.box);
+                    bins[first].count++;
+                    bins[last].exits++;
+                }
+
+                sweep(bins, [&](int split, const Volume & left, size_t n_left, const Volume & right, size_t n_right, Scalar cost)
+                {
+                    //a side with all the references would not make any progress
+                    if(cost < best.cost && n_left < references.size() && n_right < references.size())
+                    {
+                        best.cost = cost;
+                        best.axis = axis;
+                        best.position = min + split * width;
+                        best.spatial = true;
+                        best.left = left;
+                        best.right = right;
+                        best.n_left = n_left;
+                        best.n_right = n_right;
+                    }
+                }, true);
+            }
+            return best;
+        }
+
+        /*
+         * calls f(split, left box, left count, right box, right count, cost) for each split between bins [0, split) and [split, N_BINS)
+         */
+        template <typename F>
+        static void sweep(const std::array<Bin, N_BINS> & bins, F f, bool spatial = false)
+        {
+            std::array<Volume, N_BINS> right_boxes;
+            std::array<size_t, N_BINS> right_counts;
+            Volume box;
+            size_t count = 0;
+            for(int b = N_BINS - 1; b > 0; b--)
+            {
+                box.extend(bins[b].box);
+                count += spatial ? bins[b].exits : bins[b].count;
+                right_boxes[b] = box;
+                right_counts[b] = count;
+            }
+
+            box = Volume();
+            count = 0;
+            for(int b = 1; b < N_BINS; b++)
+            {
+                box.extend(bins[b - 1].box);
+                count += bins[b - 1].count;
+                if(count == 0 || right_counts[b] == 0)
+                    continue;
+                const Scalar cost = NODE_COST + OBJECT_COST * (area(box) * count + area(right_boxes[b]) * right_counts[b]);
+                f(b, box, count, right_boxes[b], right_counts[b], cost);
+            }
+        }
+
+        /*
+         * bounds of the parts of 'r''s object on each side of the plane x[axis] = position, within r.box
+         */
+        void clip(const Reference & r, int axis, Scalar position, Volume & left, Volume & right) const
+        {
+            left = Volume();
+            right = Volume();
+
+            const auto shape = _wrapper.indices(r.object);
+            const int n = int(shape.size());
+            for(int i = 0; i < n; i++)
+            {
+                const Vector v0 = _wrapper.point(shape[i]).transpose();
+                const Vector v1 = _wrapper.point(shape[(i + 1) % n]).transpose();
+                if(v0[axis] <= position)
+                    left.extend(v0);
+                if(v0[axis] >= position)
+                    right.extend(v0);
+                if((v0[axis] < position && position < v1[axis]) || (v1[axis] < position && position < v0[axis]))
+                {
+                    const Vector p = v0 + (v1 - v0) * ((position - v0[axis]) / (v1[axis] - v0[axis]));
+                    left.extend(p);
+                    right.extend(p);
+                }
+            }
+            left = left.intersection(r.box);
+            right = right.intersection(r.box);
+        }
+
+        void partition_objects(const References & references, const Split & split, const Volume & centroids, References * sides) const
+        {
+            const Scalar scale = N_BINS / (centroids.max()[split.axis] - centroids.min()[split.axis]);
+            for(const Reference & r : references)
+            {
+                const int bin = bin_of(r.box.center()[split.axis], centroids.min()[split.axis], scale);
+                sides[bin < split.bin ? 0 : 1].push_back(r);
+            }
+        }
+
+        /*
+         * references straddling the plane are split, or kept whole on one side when that is cheaper (reference unsplitting)
+         * or when 'budget' is exhausted (binning and partitioning may disagree on references touching a bin boundary)
+         */
+        void partition_spatial(const References & references, const Split & split, size_t budget, References * sides) const
+        {
+            const Scalar left_area = area(split.left), right_area = area(split.right);
+            const Scalar n_left = Scalar(split.n_left), n_right = Scalar(split.n_right);
+
+            for(const Reference & r : references)
+            {
+                if(r.box.max()[split.axis] <= split.position)
+                    sides[0].push_back(r);
+                else if(r.box.min()[split.axis] >= split.position)
+                    sides[1].push_back(r);
+                else
+                {
+                    const Scalar split_cost = left_area * n_left + right_area * n_right;
+                    const Scalar left_cost = area(split.left.merged(r.box)) * n_left + right_area * (n_right - 1);
+                    const Scalar right_cost = left_area * (n_left - 1) + area(split.right.merged(r.box)) * n_right;
+
+                    Reference parts[2] = {r, r};
+                    clip(r, split.axis, split.position, parts[0].box, parts[1].box);
+
+                    if(parts[0].box.isEmpty() || parts[1].box.isEmpty() || std::min(left_cost, right_cost) < split_cost
+                       || budget == 0)
+                    {
+                        const int side = parts[1].box.isEmpty() || (!parts[0].box.isEmpty() && left_cost < right_cost) ? 0 : 1;
+                        sides[side].push_back(r);
+                    }
+                    else
+                    {
+                        sides[0].push_back(parts[0]);
+                        sides[1].push_back(parts[1]);
+                        budget--;
+                    }
+                }
+            }
+
+            if(sides[0].empty() || sides[1].empty()) //unsplitting emptied a side, hence nothing was duplicated
+            {
+                References all;
+                all.swap(sides[0]);
+                all.insert(all.end(), sides[1].begin(), sides[1].end());
+                sides[1].clear();
+                const size_t middle = all.size() / 2;
+                sides[0].assign(all.begin(), all.begin() + middle);
+                sides[1].assign(all.begin() + middle, all.end());
+            }
+        }
+
+        Tree & _tree;
+        const BVHWrapper & _wrapper;
+        const Scalar _max_duplication;
+        std::atomic<int> _n_nodes;
+        Scalar _root_area;
+};
+
+/*
+ * Builds a FlatBVH with spatial splits over 'wrapper''s objects. Objects may be referenced by several leaves
+ */
+template <typename Tree, typename BVHWrapper>
+void build_spatial_split_bvh(Tree & tree, const BVHWrapper & wrapper, typename Tree::Scalar max_duplication = typename Tree::Scalar(2))
+{
+    SpatialSplitBVHBuilder<Tree, BVHWrapper>(tree, wrapper, max_duplication).build(wrapper.begin(), wrapper.end(), wrapper.boxes_begin(), wrapper.boxes_end());
+}
+
+}
@@ -0,0 +1,146 @@
+/*!
+* Amplitude to color mapping, on the CPU: min/max reduction, (log) normalization, lookup table and RGBA8 packing,
+* in parallel, by blocks the compiler can vectorize.
+* @author Maxime Lemonnier
+*/
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace Eigen
+{
+namespace colormap
+{
+
+typedef Matrix<float, Dynamic, 1> Amplitudes;
+typedef Matrix<uint8_t, Dynamic, 4, RowMajor> Colors; //RGBA8, one row per amplitude (or per lookup table entry)
+
+static constexpr Index GRAIN = 1 << 14; //amplitudes per task
+static constexpr Index BLOCK = 256; //amplitudes per vectorized block
+
+/*
+ * \return (min, max) of 'amplitudes', NaNs are ignored. (inf, -inf) if there is no amplitude
+ */
+inline std::pair<float, float> min_max(const Ref<const Amplitudes> & amplitudes)
+{
+    constexpr float inf = std::numeric_limits<float>::infinity();
+
+    return tbb::parallel_reduce(tbb::blocked_range<Index>(0, amplitudes.size(), GRAIN), std::make_pair(inf, -inf)
+        , [&](const tbb::blocked_range<Index> & range, std::pair<float, float> extent)
+        {
+            const auto a = amplitudes.segment(range.begin(), range.size()).array();
+            const auto is_number = a == a;
+            extent.first = std::min(extent.first, is_number.select(a, inf).minCoeff());
+            extent.second = std::max(extent.second, is_number.select(a, -inf).maxCoeff());
+            return extent;
+        }
+        , [](const std::pair<float, float> & lhs, const std::pair<float, float> & rhs)
+        {
+            return std::make_pair(std::min(lhs.first, rhs.first), std::max(lhs.second, rhs.second));
+        });
+}
+
+/*
+ * packs each lookup table entry's RGBA8 into 32 bits, memory order preserved
+ */
+inline std::vector<uint32_t> pack(const Ref<const Colors> & lut)
+{
+    std::vector<uint32_t> packed(lut.rows());
+    for(Index i = 0; i < lut.rows(); i++)
+    {
+        const uint8_t rgba[4] = {lut(i, 0), lut(i, 1), lut(i, 2), lut(i, 3)};
+        std::memcpy(&packed[i], rgba, sizeof(rgba));
+    }
+    return packed;
+}
+
+/*
+ * colors[i] = lut[n], n = t * lut.size(), where t is amplitudes[i] normalized in [min_amplitude, max_amplitude], clamped to [0, 1].
+ * With 'log_scale', n is warped to log(n) / log(lut.size()) * lut.size(): the shader's mapping (see CustomEffects.color_map())
+ * through a matplotlib LogNorm(1, lut.size()) lookup table, which does not depend on the amplitudes' units. Unlike that table's
+ * first entry (matplotlib's "bad" color), n = 0 gets lut[0]. NaN amplitudes get lut[0].
+ * 'colors' points to amplitudes.size() packed RGBA8 colors (see pack())
+ */
+inline void apply(const Ref<const Amplitudes> & amplitudes, const std::vector<uint32_t> & lut
+        , float min_amplitude, float max_amplitude, bool log_scale, uint32_t * colors)
+{
+    if(lut.empty())
+        throw std::invalid_argument("empty lookup table");
+
+    const float extent = max_amplitude - min_amplitude;
+    const float size = float(lut.size());
+    const float last = size - 1;
+    const float scale = extent > 0 ? size / extent : 0.f;
+    const float log_scale_factor = lut.size() > 1 ? size / std::log(size) : 0.f;
+
+    tbb::parallel_for(tbb::blocked_range<Index>(0, amplitudes.size(), GRAIN), [&](const tbb::blocked_range<Index> & range)
+    {
+        Array<float, Dynamic, 1, 0, BLOCK, 1> t;
+        Array<int, Dynamic, 1, 0, BLOCK, 1> indices;
+
+        for(Index begin = range.begin(); begin < range.end(); begin += BLOCK)
+        {
+            const Index size = std::min(BLOCK, range.end() - begin);
+            const auto a = amplitudes.segment(begin, size).array();
+
+            t = (a - min_amplitude) * scale;
+            if(log_scale)
+                t = t.floor().max(1.f).log() * log_scale_factor;
+            indices = (t == t).select(t, 0.f).max(0.f).min(last).template cast<int>();
+
+            for(Index i = 0; i < size; i++)
+                std::memcpy(colors + begin + i, &lut[indices[i]], sizeof(uint32_t));
+        }
+    });
+}
+
+/*
+ * Amplitude range tracked across frames: it grows to include each frame's range, and shrinks towards it by 'decay'
+ * (0: it never shrinks, 1: it is the last frame's range)
+ */
+struct RunningRange
+{
+        RunningRange(float decay = 0.f) : decay(decay) { reset(); }
+
+        void reset()
+        {
+            min = std::numeric_limits<float>::infinity();
+            max = -std::numeric_limits<float>::infinity();
+        }
+
+        std::pair<float, float> update(float frame_min, float frame_max)
+        {
+            if(frame_min <= frame_max) //else no amplitude in this frame
+            {
+                if(min > max)
+                {
+                    min = frame_min;
+                    max = frame_max;
+                }
+                else
+                {
+                    min = std::min(frame_min, min + decay * (frame_min - min));
+                    max = std::max(frame_max, max + decay * (frame_max - max));
+                }
+            }
+            return std::make_pair(min, max);
+        }
+
+        float decay;
+        float min;
+        float max;
+};
+
+}
+}
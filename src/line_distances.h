@@ -58,7 +58,7 @@ namespace distances
             throw std::invalid_argument("");
 
         Eigen::Matrix<scalar_t<Point>, 3, 3> A;
-        A.col(0) = n;
+        A.col(0) = n / std::sqrt(n.dot(n)); //unit normal, so that s is the actual distance
         A.col(1) = direction0;
         A.col(2) = direction1;
         return A;
@@ -233,30 +233,36 @@ namespace distances
         {
             size_t next_e = (e+1)%3u;
             const Point & edge_origin = *(origins[e]);
-            Scalar u = e == 0 ? 1 : 0;
-            Scalar v = e == 1 ? 1 : 0;
             const Point & edge_end = *(origins[next_e]);
             Point edge_direction = (edge_end - edge_origin);
             Scalar norm = std::sqrt(edge_direction.dot(edge_direction));
             edge_direction /= norm;
             auto stu = line_line_distance(edge_origin, edge_direction, origin, direction);
 
+            // barycentric coordinates (u, v) of the point at fraction 'a' of edge e
+            auto edge_tuv = [&](Scalar t, Scalar a)
+            {
+                switch(e)
+                {
+                    case 0 : return Point(t, a, 0);
+                    case 1 : return Point(t, 1 - a, a);
+                    default: return Point(t, 0, 1 - a);
+                }
+            };
 
             if(stu[1] < 0)
             {
                 const Scalar d = line_point_distance(origin, direction, edge_origin, stu[2]);
-                update_result(d, [&](){return Point(stu[1], u, v);});
+                update_result(d, [&](){return edge_tuv(stu[2], 0);});
             }
-            else if (stu[1] <= 1) // if stu[1] > 1, then another edge test will have stu[1] < 0 since an edge origin is another edge's end
+            else if (stu[1] > norm)
             {
-                switch(e)
-                {
-                    case 0 : u = stu[1];     v = 1 - stu[1]; break;
-                    case 1 : u = 0;          v = stu[1];     break;
-                    case 2 : u = 1 - stu[1]; v = 0;          break;
-                }
-
-                update_result(std::fabs(stu[0]), [&](){return Point(stu[2], u / norm, v / norm);});
+                const Scalar d = line_point_distance(origin, direction, edge_end, stu[2]);
+                update_result(d, [&](){return edge_tuv(stu[2], 1);});
+            }
+            else
+            {
+                update_result(std::fabs(stu[0]), [&](){return edge_tuv(stu[2], stu[1] / norm);});
             }
         }
         return std::make_tuple(min_dist, tuv);
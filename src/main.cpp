@@ -12,7 +12,10 @@
 #include <functional>
 #include <iostream>
 #include <numeric>
+#include <memory>
 #include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/partitioner.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/eigen.h>
@@ -20,32 +23,124 @@
 #include <Eigen/Dense>
 #include <unsupported/Eigen/BVH>
 #include "BVHWrapper.h"
+#include "BVHTree.h"
 #include "RayPointsQuery.h"
 #include "RayTrianglesQuery.h"
+#include "RayConeQuery.h"
+#include "ray_ordering.h"
+#include "DualTreeQuery.h"
+#include "Raycaster.h"
+#include "BVHHandle.h"
+#include "Profiler.h"
+#include "colormap.h"
 
 namespace py = pybind11;
 
 using namespace Eigen;
+
+template <typename PyBVH>
+typename PyBVH::Wrapper::Points && check_refit(const PyBVH & bvh, typename PyBVH::Wrapper::Points && vertices)
+{
+    if(vertices.rows() != bvh._vertices.rows())
+        throw std::invalid_argument("refitting expects as many vertices as the refitted BVH has");
+    return std::move(vertices);
+}
+
+/*
+ * published BVHs (see BVHHandle) are queried concurrently, their masks must not change
+ */
+template <typename PyBVH>
+void check_mutable(const PyBVH & bvh)
+{
+    if(bvh._frozen)
+        throw std::runtime_error("this BVH is a published snapshot, it is immutable: pass masks to BVHHandle.build() instead");
+}
+
+/*
+ * casts one cone per ray (see RayConeQuery) in a single traversal each,
+ * \return (offsets, ids, distances, tuvs), ray i's hits lying in [offsets[i], offsets[i+1]), sorted by t then distance
+ */
+template <typename Tree, typename Wrapper>
+decltype(auto) cast_cones(const Tree & tree, const Wrapper & wrapper, const Ref<const typename Wrapper::Points> origins, const Ref<const typename Wrapper::Points> directions
+        , float radius, float slope, bool keep_closest_only, bool reorder, const MaskFilter & filter)
+{
+    typedef RayConeQuery<typename Tree::KdTree, Wrapper> ConeQuery;
+    size_t n_rays = origins.rows();
+
+    std::vector<typename ConeQuery::Hits> results(n_rays);
+    ordering::parallel_for_rays(origins, directions, reorder, [&](size_t i)
+    {
+        ConeQuery query(wrapper, origins.row(i), directions.row(i), radius, slope, keep_closest_only);
+        tree.visit(filter, [&](const auto & t){BVIntersect(t, query);});
+        results[i] = std::move(query.sorted());
+        if(keep_closest_only && results[i].size() > 1)
+            results[i].resize(1);
+    });
+
+    Matrix<int, Dynamic, 1u> offsets(n_rays + 1, 1);
+    offsets[0] = 0;
+    for(size_t r = 0; r < n_rays; r++)
+        offsets[r + 1] = offsets[r] + int(results[r].size());
+
+    Matrix<int, Dynamic, 1u> ids(offsets[n_rays], 1);
+    Matrix<float, Dynamic, 1u> distances(offsets[n_rays], 1);
+    Matrix<float, Dynamic, 3u> tuvs(offsets[n_rays], 3);
+    for(size_t r = 0; r < n_rays; r++)
+    {
+        for(size_t h = 0; h < results[r].size(); h++)
+        {
+            const size_t i = offsets[r] + h;
+            ids[i] = results[r][h].id;
+            distances[i] = results[r][h].distance;
+            tuvs.row(i) = results[r][h].tuv;
+        }
+    }
+    return std::make_tuple(offsets, ids, distances, tuvs);
+}
+
+class PyPointsBVH;
+
 class PyTrianglesBVH
 {
 public:
     typedef BVHWrapper<int, float,3, 3> Wrapper;
-    typedef KdBVH<float, 3, size_t> BVH;
-    typedef RayTrianglesQuery<BVH, Wrapper> Query;
+    typedef BVHTree<Wrapper> Tree;
+    typedef RayTrianglesQuery<Tree::KdTree, Wrapper> Query;
+    typedef Matrix<uint32_t, Dynamic, 1> Masks;
+    typedef Matrix<int, Dynamic, 2, RowMajor> PairIds;
+    typedef Matrix<float, Dynamic, 1> PairDistances;
 
 
-    PyTrianglesBVH(const Ref<const Wrapper::Indices> triangles, const Ref<const Wrapper::Points> vertices) :
+    PyTrianglesBVH(const Ref<const Wrapper::Indices> triangles, const Ref<const Wrapper::Points> vertices, BuildMethod build_method = BuildMethod::KD, float max_duplication = 2.f) :
         _triangles(triangles), _vertices(vertices), _wrapper(_triangles, _vertices)
-        , _tree(_wrapper.begin(), _wrapper.end(), _wrapper.boxes_begin(), _wrapper.boxes_end())
+        , _tree(_wrapper, build_method, max_duplication), _frozen(false)
+    {
+
+    }
+
+    PyTrianglesBVH(Wrapper::Indices && triangles, Wrapper::Points && vertices, BuildMethod build_method = BuildMethod::KD, float max_duplication = 2.f) :
+        _triangles(std::move(triangles)), _vertices(std::move(vertices)), _wrapper(_triangles, _vertices)
+        , _tree(_wrapper, build_method, max_duplication), _frozen(false)
+    {
+
+    }
+
+    /*
+     * 'other' with new vertices, its hierarchy being refitted (see BVHTree), not frozen even if 'other' is
+     */
+    PyTrianglesBVH(const PyTrianglesBVH & other, Wrapper::Points && vertices) :
+        _triangles(other._triangles), _vertices(check_refit(other, std::move(vertices))), _wrapper(_triangles, _vertices)
+        , _tree(other._tree, _wrapper), _mask_sources(other._mask_sources), _frozen(false)
     {
 
     }
 
-    decltype(auto) intersect_ray(const Eigen::Ref<const Query::Point> origin, const Eigen::Ref<const Query::Point> direction, bool keep_closest_only = false)
+    decltype(auto) intersect_ray(const Eigen::Ref<const Query::Point> origin, const Eigen::Ref<const Query::Point> direction, bool keep_closest_only = false, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
     {
+        const MaskFilter filter{include_mask, exclude_mask};
         Query query(_wrapper, origin, direction);
 
-        BVIntersect(_tree, query);
+        _tree.visit(filter, [&](const auto & tree){BVIntersect(tree, query);});
 
         auto results = query.sorted();
 
@@ -67,20 +162,21 @@ public:
         return std::make_tuple(ids, tuvs);
     }
 
-    decltype(auto) intersect_rays(const Ref<const Wrapper::Points> origins, const Ref<const Wrapper::Points> directions, float threshold = 0.f, bool keep_closest_only = false)
+    decltype(auto) intersect_rays(const Ref<const Wrapper::Points> origins, const Ref<const Wrapper::Points> directions, float threshold = 0.f, bool keep_closest_only = false, bool reorder = false, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
     {
+        const MaskFilter filter{include_mask, exclude_mask};
         size_t n_rays = origins.rows();
 
         std::vector<Query::Intersections> results(n_rays);
-        tbb::parallel_for(size_t(0), n_rays, [&](auto i)
+        ordering::parallel_for_rays(origins, directions, reorder, [&](size_t i)
         //for(size_t i = 0; i < n_rays; i++)
         {
             Query query(_wrapper, origins.row(i), directions.row(i));
-            BVIntersect(_tree, query);
+            _tree.visit(filter, [&](const auto & tree){BVIntersect(tree, query);});
 
             if(threshold > 0 && query.intersections.empty())
             {
-                if(BVMinimize(_tree, query) < threshold)
+                if(_tree.visit(filter, [&](const auto & tree){return BVMinimize(tree, query);}) < threshold)
                     results[i].emplace_back(Query::Intersection{query.minimum.id, query.minimum.tuv});
             }
             else
@@ -129,17 +225,33 @@ public:
     }
 
 
-    decltype(auto) ray_distance(const Eigen::Ref<const Query::Point> origin, const Eigen::Ref<const Query::Point> direction)
+    decltype(auto) ray_distance(const Eigen::Ref<const Query::Point> origin, const Eigen::Ref<const Query::Point> direction, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
     {
+        const MaskFilter filter{include_mask, exclude_mask};
         Query query(_wrapper, origin, direction);
 
-        BVMinimize(_tree, query);
+        _tree.visit(filter, [&](const auto & tree){return BVMinimize(tree, query);});
 
         return std::make_tuple(query.minimum.id, query.minimum.distance, query.minimum.tuv);
     }
 
-    decltype(auto) rays_distances(const Ref<const Wrapper::Points> origins, const Ref<const Wrapper::Points> directions)
+    /*
+     * triangles within 'radius' + 'slope' * t of the ray, \return (ids, distances, tuvs) sorted by t, then distance
+     */
+    decltype(auto) cone_cast(const Eigen::Ref<const Query::Point> origin, const Eigen::Ref<const Query::Point> direction, float radius, float slope = 0.f, bool keep_closest_only = false, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
     {
+        auto results = cast_cones(_tree, _wrapper, origin, direction, radius, slope, keep_closest_only, false, MaskFilter{include_mask, exclude_mask});
+        return std::make_tuple(std::get<1>(results), std::get<2>(results), std::get<3>(results));
+    }
+
+    decltype(auto) cone_casts(const Ref<const Wrapper::Points> origins, const Ref<const Wrapper::Points> directions, float radius, float slope = 0.f, bool keep_closest_only = false, bool reorder = false, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
+    {
+        return cast_cones(_tree, _wrapper, origins, directions, radius, slope, keep_closest_only, reorder, MaskFilter{include_mask, exclude_mask});
+    }
+
+    decltype(auto) rays_distances(const Ref<const Wrapper::Points> origins, const Ref<const Wrapper::Points> directions, bool reorder = false, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
+    {
+        const MaskFilter filter{include_mask, exclude_mask};
         size_t n_rays = origins.rows();
         Matrix<int, Dynamic, 1u> ids;
         Matrix<float, Dynamic, 1u> distances;
@@ -148,11 +260,11 @@ public:
         ids.resize(n_rays, 1);
         distances.resize(n_rays, 1);
         tuvs.resize(n_rays, 3);
-        tbb::parallel_for(size_t(0), n_rays, [&](auto i)
+        ordering::parallel_for_rays(origins, directions, reorder, [&](size_t i)
         //for(size_t i = 0; i < n_rays; i++)
         {
             Query query(_wrapper, origins.row(i), directions.row(i));
-            BVMinimize(_tree, query);
+            _tree.visit(filter, [&](const auto & tree){return BVMinimize(tree, query);});
             ids[i] = query.minimum.id;
             distances[i] = query.minimum.distance;
             tuvs.row(i) = query.minimum.tuv;
@@ -161,10 +273,94 @@ public:
 
         return std::make_tuple(ids, distances, tuvs);
     }
+
+    void set_masks(const Ref<const Masks> masks)
+    {
+        check_mutable(*this);
+        _mask_sources.primitive_masks.assign(masks.data(), masks.data() + masks.size());
+        update_masks();
+    }
+
+    void set_instances(const Ref<const Masks> instance_ids, const Ref<const Masks> instance_masks)
+    {
+        check_mutable(*this);
+        _mask_sources.instance_ids.assign(instance_ids.data(), instance_ids.data() + instance_ids.size());
+        _mask_sources.instance_masks.assign(instance_masks.data(), instance_masks.data() + instance_masks.size());
+        update_masks();
+    }
+
+    void update_masks()
+    {
+        _tree.set_masks(_mask_sources.combine(_wrapper.n_objects()));
+    }
+
+    /*
+     * \return a copy: set_masks() and set_instances() replace the tree's masks
+     */
+    Masks masks() const
+    {
+        return Map<const Masks>(_tree.masks().data(), _tree.masks().size());
+    }
+
+    /*
+     * makes set_masks() and set_instances() throw, BVHHandle freezes the BVHs it publishes
+     */
+    void freeze()
+    {
+        _frozen = true;
+    }
+
+    /*
+     * pairs of (this BVH's triangle, 'other' BVH's triangle) that intersect,
+     * 'transform' maps 'other' BVH's vertices into this BVH's referential
+     */
+    PairIds overlaps(const PyTrianglesBVH & other, const Ref<const Matrix4f> transform)
+    {
+        return std::get<0>(pairs_within(other, 0.f, transform));
+    }
+
+    /*
+     * pairs of (this BVH's triangle, 'other' BVH's triangle) within 'distance', and their distances
+     */
+    std::tuple<PairIds, PairDistances> pairs_within(const PyTrianglesBVH & other, float distance, const Ref<const Matrix4f> transform)
+    {
+        const Transform<float, 3, Affine> b_to_a(transform);
+        const TrianglesPairTest<Wrapper, Wrapper> test{_wrapper, other._wrapper, b_to_a, distance};
+
+        return _tree.visit([&](const auto & a)
+        {
+            return other._tree.visit([&](const auto & b)
+            {
+                return to_arrays(dual_tree_pairs(a, _wrapper.boxes_begin(), b, other._wrapper.boxes_begin(), b_to_a, test));
+            });
+        });
+    }
+
+    /*
+     * pairs of (this BVH's triangle, 'other' BVH's point) within 'distance', and their distances
+     */
+    std::tuple<PairIds, PairDistances> points_within(const PyPointsBVH & other, float distance, const Ref<const Matrix4f> transform);
+
+    template <typename Pairs>
+    static std::tuple<PairIds, PairDistances> to_arrays(const Pairs & pairs)
+    {
+        PairIds ids(pairs.size(), 2);
+        PairDistances distances(pairs.size());
+        for(size_t i = 0; i < pairs.size(); i++)
+        {
+            ids(i, 0) = int(pairs[i].first);
+            ids(i, 1) = int(pairs[i].second);
+            distances[i] = pairs[i].distance;
+        }
+        return std::make_tuple(ids, distances);
+    }
+
     const Wrapper::Indices _triangles; //TODO avoid copy
     const Wrapper::Points _vertices;
     Wrapper _wrapper;
-    BVH _tree;
+    Tree _tree;
+    MaskSources _mask_sources;
+    bool _frozen;
 };
 
 
@@ -172,27 +368,60 @@ class PyPointsBVH
 {
 public:
     typedef BVHWrapper<int, float, 1, 3> Wrapper;
-    typedef KdBVH<float, 3, size_t> BVH;
-    typedef RayPointsQuery<BVH, Wrapper> Query;
+    typedef BVHTree<Wrapper> Tree;
+    typedef RayPointsQuery<Tree::KdTree, Wrapper> Query;
+    typedef Matrix<uint32_t, Dynamic, 1> Masks;
 
 
-    PyPointsBVH(const Ref<const Wrapper::Indices> indices, const Ref<const Wrapper::Points> vertices) :
+    PyPointsBVH(const Ref<const Wrapper::Indices> indices, const Ref<const Wrapper::Points> vertices, BuildMethod build_method = BuildMethod::KD, float max_duplication = 2.f) :
         _indices(indices), _vertices(vertices), _wrapper(_indices, _vertices)
-        , _tree(_wrapper.begin(), _wrapper.end(), _wrapper.boxes_begin(), _wrapper.boxes_end())
+        , _tree(_wrapper, build_method, max_duplication), _frozen(false)
+    {
+    }
+
+    PyPointsBVH(Wrapper::Indices && indices, Wrapper::Points && vertices, BuildMethod build_method = BuildMethod::KD, float max_duplication = 2.f) :
+        _indices(std::move(indices)), _vertices(std::move(vertices)), _wrapper(_indices, _vertices)
+        , _tree(_wrapper, build_method, max_duplication), _frozen(false)
     {
     }
 
-    decltype(auto) ray_distance(const Eigen::Ref<const Query::Point> origin, const Eigen::Ref<const Query::Point> direction)
+    /*
+     * 'other' with new vertices, its hierarchy being refitted (see BVHTree), not frozen even if 'other' is
+     */
+    PyPointsBVH(const PyPointsBVH & other, Wrapper::Points && vertices) :
+        _indices(other._indices), _vertices(check_refit(other, std::move(vertices))), _wrapper(_indices, _vertices)
+        , _tree(other._tree, _wrapper), _mask_sources(other._mask_sources), _frozen(false)
     {
+    }
+
+    decltype(auto) ray_distance(const Eigen::Ref<const Query::Point> origin, const Eigen::Ref<const Query::Point> direction, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
+    {
+        const MaskFilter filter{include_mask, exclude_mask};
         Query query(_wrapper, origin, direction);
 
-        BVMinimize(_tree, query);
+        _tree.visit(filter, [&](const auto & tree){return BVMinimize(tree, query);});
 
         return std::make_tuple(query.minimum.id, query.minimum.distance, query.minimum.t);
     }
 
-    decltype(auto) rays_distances(const Ref<const Wrapper::Points> origins, const Ref<const Wrapper::Points> directions)
+    /*
+     * points within 'radius' + 'slope' * t of the ray, \return (ids, distances, t) sorted by t, then distance
+     */
+    decltype(auto) cone_cast(const Eigen::Ref<const Query::Point> origin, const Eigen::Ref<const Query::Point> direction, float radius, float slope = 0.f, bool keep_closest_only = false, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
+    {
+        auto results = cast_cones(_tree, _wrapper, origin, direction, radius, slope, keep_closest_only, false, MaskFilter{include_mask, exclude_mask});
+        return std::make_tuple(std::get<1>(results), std::get<2>(results), std::get<3>(results).col(0).eval());
+    }
+
+    decltype(auto) cone_casts(const Ref<const Wrapper::Points> origins, const Ref<const Wrapper::Points> directions, float radius, float slope = 0.f, bool keep_closest_only = false, bool reorder = false, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
+    {
+        auto results = cast_cones(_tree, _wrapper, origins, directions, radius, slope, keep_closest_only, reorder, MaskFilter{include_mask, exclude_mask});
+        return std::make_tuple(std::get<0>(results), std::get<1>(results), std::get<2>(results), std::get<3>(results).col(0).eval());
+    }
+
+    decltype(auto) rays_distances(const Ref<const Wrapper::Points> origins, const Ref<const Wrapper::Points> directions, bool reorder = false, uint32_t include_mask = ~0u, uint32_t exclude_mask = 0u)
     {
+        const MaskFilter filter{include_mask, exclude_mask};
         size_t n_rays = origins.rows();
         Matrix<int, Dynamic, 1u> ids;
         Matrix<float, Dynamic, 1u> distances;
@@ -201,11 +430,11 @@ public:
         ids.resize(n_rays, 1);
         distances.resize(n_rays, 1);
         t.resize(n_rays, 3);
-        tbb::parallel_for(size_t(0), n_rays, [&](auto i)
+        ordering::parallel_for_rays(origins, directions, reorder, [&](size_t i)
         //for(size_t i = 0; i < n_rays; i++)
         {
             Query query(_wrapper, origins.row(i), directions.row(i));
-            BVMinimize(_tree, query);
+            _tree.visit(filter, [&](const auto & tree){return BVMinimize(tree, query);});
             ids[i] = query.minimum.id;
             distances[i] = query.minimum.distance;
             t[i] = query.minimum.t;
@@ -214,30 +443,276 @@ public:
 
         return std::make_tuple(ids, distances, t);
     }
+
+    void set_masks(const Ref<const Masks> masks)
+    {
+        check_mutable(*this);
+        _mask_sources.primitive_masks.assign(masks.data(), masks.data() + masks.size());
+        update_masks();
+    }
+
+    void set_instances(const Ref<const Masks> instance_ids, const Ref<const Masks> instance_masks)
+    {
+        check_mutable(*this);
+        _mask_sources.instance_ids.assign(instance_ids.data(), instance_ids.data() + instance_ids.size());
+        _mask_sources.instance_masks.assign(instance_masks.data(), instance_masks.data() + instance_masks.size());
+        update_masks();
+    }
+
+    void update_masks()
+    {
+        _tree.set_masks(_mask_sources.combine(_wrapper.n_objects()));
+    }
+
+    /*
+     * \return a copy: set_masks() and set_instances() replace the tree's masks
+     */
+    Masks masks() const
+    {
+        return Map<const Masks>(_tree.masks().data(), _tree.masks().size());
+    }
+
+    /*
+     * makes set_masks() and set_instances() throw, BVHHandle freezes the BVHs it publishes
+     */
+    void freeze()
+    {
+        _frozen = true;
+    }
+
     const Wrapper::Indices _indices; //TODO avoid copy
     const Wrapper::Points _vertices;
     Wrapper _wrapper;
-    BVH _tree;
+    Tree _tree;
+    MaskSources _mask_sources;
+    bool _frozen;
+};
+
+/*
+ * builds one BVH per (indices, vertices) mesh. Meshes are built concurrently, largest first,
+ * and large meshes' builds are themselves parallel. \return BVHs in input order
+ */
+template <typename PyBVH>
+std::vector<std::shared_ptr<PyBVH>> build_many(std::vector<std::tuple<typename PyBVH::Wrapper::Indices, typename PyBVH::Wrapper::Points>> meshes, BuildMethod build_method = BuildMethod::KD, float max_duplication = 2.f)
+{
+    std::vector<size_t> order(meshes.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs)
+    {
+        return std::get<0>(meshes[lhs]).rows() > std::get<0>(meshes[rhs]).rows();
+    });
+
+    std::vector<std::shared_ptr<PyBVH>> bvhs(meshes.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, order.size(), 1), [&](const tbb::blocked_range<size_t> & range)
+    {
+        static const uint32_t span = profiling::intern("bvh.build_many.mesh");
+        for(size_t i = range.begin(); i != range.end(); i++)
+        {
+            profiling::ScopedTimer timer(span);
+            auto & mesh = meshes[order[i]];
+            bvhs[order[i]].reset(new PyBVH(std::move(std::get<0>(mesh)), std::move(std::get<1>(mesh)), build_method, max_duplication));
+        }
+    }, tbb::simple_partitioner());
+
+    return bvhs;
+}
+
+std::tuple<PyTrianglesBVH::PairIds, PyTrianglesBVH::PairDistances> PyTrianglesBVH::points_within(const PyPointsBVH & other, float distance, const Ref<const Matrix4f> transform)
+{
+    const Transform<float, 3, Affine> b_to_a(transform);
+    const TrianglePointPairTest<Wrapper, PyPointsBVH::Wrapper> test{_wrapper, other._wrapper, b_to_a, distance};
+
+    return _tree.visit([&](const auto & a)
+    {
+        return other._tree.visit([&](const auto & b)
+        {
+            return to_arrays(dual_tree_pairs(a, _wrapper.boxes_begin(), b, other._wrapper.boxes_begin(), b_to_a, test));
+        });
+    });
+}
+
+class PyRaycaster : public Raycaster<PyTrianglesBVH::Wrapper, PyPointsBVH::Wrapper>
+{
+public:
+    typedef Raycaster<PyTrianglesBVH::Wrapper, PyPointsBVH::Wrapper> Base;
+
+    PyRaycaster(int width, int height) : Base(width, height)
+    {
+    }
+
+    void add_triangles(const PyTrianglesBVH & bvh, const Matrix4f & model, const Vector4f & color)
+    {
+        Base::add_triangles(bvh._tree, bvh._wrapper, model, color);
+    }
+
+    void add_points(const PyPointsBVH & bvh, const Matrix4f & model, const Vector4f & color, float point_size = 1.f)
+    {
+        Base::add_points(bvh._tree, bvh._wrapper, model, color, point_size);
+    }
+
+    /*
+     * \return (number of rays, seconds, Mrays/s)
+     */
+    decltype(auto) render(int step = 1)
+    {
+        auto stats = Base::render(step);
+        return std::make_tuple(stats.n_rays, stats.seconds, stats.mrays_per_s());
+    }
 };
 
+template <typename PyBVH>
+void bind_handle(py::module & m, const char * name, const char * indices_name)
+{
+    typedef BVHHandle<PyBVH> Handle;
+    py::class_<Handle>(m, name)
+        .def(py::init<>())
+        .def("build", &Handle::build
+            , py::arg(indices_name), py::arg("vertices"), py::arg("build_method") = BuildMethod::KD, py::arg("masks") = typename Handle::Masks(), py::arg("max_duplication") = 2.f
+            , py::call_guard<py::gil_scoped_release>())
+        .def("refit", &Handle::refit, py::arg("vertices"), py::call_guard<py::gil_scoped_release>())
+        .def("snapshot", &Handle::snapshot)
+        .def("wait", &Handle::wait, py::call_guard<py::gil_scoped_release>())
+        .def("rethrow", &Handle::rethrow)
+        .def_property_readonly("pending", &Handle::pending)
+        .def_property_readonly("version", &Handle::version)
+        .def_property_readonly("submitted", &Handle::submitted)
+        ;
+}
+
 PYBIND11_MODULE(PyBVH, m) {
-    py::class_<PyTrianglesBVH>(m, "BVH")
-        .def(py::init<const Ref<const PyTrianglesBVH::Wrapper::Indices>, const Ref<const PyTrianglesBVH::Wrapper::Points>>())
-        .def("intersect_ray", &PyTrianglesBVH::intersect_ray)
-        .def("intersect_rays", &PyTrianglesBVH::intersect_rays)
-        .def("ray_distance", &PyTrianglesBVH::ray_distance)
-        .def("rays_distances", &PyTrianglesBVH::rays_distances)
+    py::enum_<BuildMethod>(m, "BuildMethod")
+        .value("KD", BuildMethod::KD)
+        .value("LBVH", BuildMethod::LBVH)
+        .value("LBVH_TREELETS", BuildMethod::LBVH_TREELETS)
+        .value("SBVH", BuildMethod::SBVH)
+        ;
+
+    py::class_<PyTrianglesBVH, std::shared_ptr<PyTrianglesBVH>>(m, "BVH")
+        .def(py::init<const Ref<const PyTrianglesBVH::Wrapper::Indices>, const Ref<const PyTrianglesBVH::Wrapper::Points>, BuildMethod, float>()
+            , py::arg("triangles"), py::arg("vertices"), py::arg("build_method") = BuildMethod::KD, py::arg("max_duplication") = 2.f)
+        .def_static("build_many", &build_many<PyTrianglesBVH>
+            , py::arg("meshes"), py::arg("build_method") = BuildMethod::KD, py::arg("max_duplication") = 2.f, py::call_guard<py::gil_scoped_release>())
+        .def("intersect_ray", &PyTrianglesBVH::intersect_ray
+            , py::arg("origin"), py::arg("direction"), py::arg("keep_closest_only") = false, py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("intersect_rays", &PyTrianglesBVH::intersect_rays
+            , py::arg("origins"), py::arg("directions"), py::arg("threshold") = 0.f, py::arg("keep_closest_only") = false, py::arg("reorder") = false, py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("ray_distance", &PyTrianglesBVH::ray_distance
+            , py::arg("origin"), py::arg("direction"), py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("rays_distances", &PyTrianglesBVH::rays_distances
+            , py::arg("origins"), py::arg("directions"), py::arg("reorder") = false, py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("cone_cast", &PyTrianglesBVH::cone_cast
+            , py::arg("origin"), py::arg("direction"), py::arg("radius"), py::arg("slope") = 0.f, py::arg("keep_closest_only") = false, py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("cone_casts", &PyTrianglesBVH::cone_casts
+            , py::arg("origins"), py::arg("directions"), py::arg("radius"), py::arg("slope") = 0.f, py::arg("keep_closest_only") = false, py::arg("reorder") = false, py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("set_masks", &PyTrianglesBVH::set_masks, py::arg("masks"))
+        .def("set_instances", &PyTrianglesBVH::set_instances, py::arg("instance_ids"), py::arg("instance_masks"))
+        .def("overlaps", &PyTrianglesBVH::overlaps
+            , py::arg("other"), py::arg("transform") = Matrix4f(Matrix4f::Identity()), py::call_guard<py::gil_scoped_release>())
+        .def("pairs_within", &PyTrianglesBVH::pairs_within
+            , py::arg("other"), py::arg("distance"), py::arg("transform") = Matrix4f(Matrix4f::Identity()), py::call_guard<py::gil_scoped_release>())
+        .def("points_within", &PyTrianglesBVH::points_within
+            , py::arg("other"), py::arg("distance"), py::arg("transform") = Matrix4f(Matrix4f::Identity()), py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("masks", &PyTrianglesBVH::masks)
+        .def_readonly("frozen", &PyTrianglesBVH::_frozen)
         .def_readonly("triangles", &PyTrianglesBVH::_triangles)
         .def_readonly("vertices", &PyTrianglesBVH::_vertices)
         ;
 
-    py::class_<PyPointsBVH>(m, "PointsBVH")
-        .def(py::init<const Ref<const PyPointsBVH::Wrapper::Indices>, const Ref<const PyPointsBVH::Wrapper::Points> >())
-        .def("ray_distance", &PyPointsBVH::ray_distance)
-        .def("rays_distances", &PyPointsBVH::rays_distances)
+    py::class_<PyPointsBVH, std::shared_ptr<PyPointsBVH>>(m, "PointsBVH")
+        .def(py::init<const Ref<const PyPointsBVH::Wrapper::Indices>, const Ref<const PyPointsBVH::Wrapper::Points>, BuildMethod, float>()
+            , py::arg("indices"), py::arg("vertices"), py::arg("build_method") = BuildMethod::KD, py::arg("max_duplication") = 2.f)
+        .def_static("build_many", &build_many<PyPointsBVH>
+            , py::arg("meshes"), py::arg("build_method") = BuildMethod::KD, py::arg("max_duplication") = 2.f, py::call_guard<py::gil_scoped_release>())
+        .def("ray_distance", &PyPointsBVH::ray_distance
+            , py::arg("origin"), py::arg("direction"), py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("rays_distances", &PyPointsBVH::rays_distances
+            , py::arg("origins"), py::arg("directions"), py::arg("reorder") = false, py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("cone_cast", &PyPointsBVH::cone_cast
+            , py::arg("origin"), py::arg("direction"), py::arg("radius"), py::arg("slope") = 0.f, py::arg("keep_closest_only") = false, py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("cone_casts", &PyPointsBVH::cone_casts
+            , py::arg("origins"), py::arg("directions"), py::arg("radius"), py::arg("slope") = 0.f, py::arg("keep_closest_only") = false, py::arg("reorder") = false, py::arg("include_mask") = ~0u, py::arg("exclude_mask") = 0u)
+        .def("set_masks", &PyPointsBVH::set_masks, py::arg("masks"))
+        .def("set_instances", &PyPointsBVH::set_instances, py::arg("instance_ids"), py::arg("instance_masks"))
+        .def_property_readonly("masks", &PyPointsBVH::masks)
+        .def_readonly("frozen", &PyPointsBVH::_frozen)
+        .def_readonly("indices", &PyPointsBVH::_indices)
         .def_readonly("vertices", &PyPointsBVH::_vertices)
         ;
 
+    m.attr("DEFAULT_MASK") = uint32_t(BVHMasks::DEFAULT_MASK); //the mask of primitives without masks
+
+    py::module profiler = m.def_submodule("profiler", "frame timeline profiler, see Profiler.h");
+    profiler.def("enable", [](bool enabled, size_t capacity){ profiling::Profiler::instance().enable(enabled, capacity); }
+            , py::arg("enabled") = true, py::arg("capacity") = profiling::Profiler::DEFAULT_CAPACITY)
+        .def("enabled", []{ return profiling::Profiler::instance().enabled(); })
+        .def("intern", &profiling::intern, py::arg("name"))
+        .def("now", &profiling::now)
+        .def("record", [](uint32_t name, int64_t begin, int64_t end){ profiling::Profiler::instance().record(name, begin, end); }
+            , py::arg("name"), py::arg("begin"), py::arg("end"))
+        .def("begin_frame", []{ return profiling::Profiler::instance().begin_frame(); })
+        .def("frame", []{ return profiling::Profiler::instance().frame(); })
+        .def("clear", []{ profiling::Profiler::instance().clear(); })
+        .def("chrome_trace", []{ return profiling::Profiler::instance().chrome_trace(); }, py::call_guard<py::gil_scoped_release>())
+        .def("frame_stats", []
+        {
+            //name -> (n_frames, n_spans, p50, p99, max), durations in ms
+            std::map<std::string, std::tuple<size_t, size_t, double, double, double>> stats;
+            for(const auto & s : profiling::Profiler::instance().frame_stats())
+                stats[s.first] = std::make_tuple(s.second.n_frames, s.second.n_spans, s.second.p50, s.second.p99, s.second.max);
+            return stats;
+        })
+        ;
+
+    py::module cmap = m.def_submodule("colormap", "amplitude to RGBA8 color mapping, see colormap.h");
+    cmap.def("min_max", &colormap::min_max, py::arg("amplitudes"), py::call_guard<py::gil_scoped_release>())
+        .def("apply", [](const Ref<const colormap::Amplitudes> amplitudes, const Ref<const colormap::Colors> lut, Ref<colormap::Colors> colors
+                , float min_amplitude, float max_amplitude, bool log_scale)
+        {
+            if(colors.rows() != amplitudes.size() || colors.outerStride() != 4)
+                throw std::invalid_argument("colors must be a contiguous (len(amplitudes), 4) uint8 array");
+            colormap::apply(amplitudes, colormap::pack(lut), min_amplitude, max_amplitude, log_scale, reinterpret_cast<uint32_t*>(colors.data()));
+        }
+            , py::arg("amplitudes"), py::arg("lut"), py::arg("colors"), py::arg("min_amplitude"), py::arg("max_amplitude"), py::arg("log_scale") = false
+            , py::call_guard<py::gil_scoped_release>())
+        ;
+
+    py::class_<colormap::RunningRange>(cmap, "RunningRange")
+        .def(py::init<float>(), py::arg("decay") = 0.f)
+        .def("update", [](colormap::RunningRange & range, const Ref<const colormap::Amplitudes> amplitudes)
+        {
+            auto extent = colormap::min_max(amplitudes);
+            return range.update(extent.first, extent.second);
+        }
+            , py::arg("amplitudes"), py::call_guard<py::gil_scoped_release>())
+        .def("reset", &colormap::RunningRange::reset)
+        .def_readwrite("decay", &colormap::RunningRange::decay)
+        .def_readonly("min", &colormap::RunningRange::min)
+        .def_readonly("max", &colormap::RunningRange::max)
+        ;
+
+    bind_handle<PyTrianglesBVH>(m, "BVHHandle", "triangles");
+    bind_handle<PyPointsBVH>(m, "PointsBVHHandle", "indices");
+
+    py::class_<PyRaycaster>(m, "Raycaster")
+        .def(py::init<int, int>(), py::arg("width"), py::arg("height"))
+        .def("set_camera", &PyRaycaster::set_camera, py::arg("view"), py::arg("projection"))
+        .def("add_triangles", &PyRaycaster::add_triangles
+            , py::arg("bvh"), py::arg("model"), py::arg("color"), py::keep_alive<1, 2>())
+        .def("add_points", &PyRaycaster::add_points
+            , py::arg("bvh"), py::arg("model"), py::arg("color"), py::arg("point_size") = 1.f, py::keep_alive<1, 2>())
+        .def("clear", &PyRaycaster::clear)
+        .def("invalidate", &PyRaycaster::invalidate)
+        .def("render", &PyRaycaster::render, py::arg("step") = 1, py::call_guard<py::gil_scoped_release>())
+        .def_readwrite("ambient", &PyRaycaster::ambient)
+        .def_readwrite("background", &PyRaycaster::background)
+        .def_property_readonly("width", &PyRaycaster::width)
+        .def_property_readonly("height", &PyRaycaster::height)
+        .def_property_readonly("depths", &PyRaycaster::depths)
+        .def_property_readonly("normals", &PyRaycaster::normals)
+        .def_property_readonly("ids", &PyRaycaster::ids)
+        .def_property_readonly("colors", &PyRaycaster::colors)
+        ;
+
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
 #else
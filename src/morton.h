@@ -0,0 +1,152 @@
+/*
+ * morton.h
+ *
+ *  Morton (Z-order) codes and a parallel LSD radix sort to order them
+ *
+ *      Author: Maxime Lemonnier
+ */
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace morton
+{
+    /*
+     * number of leading zero bits, 32 for 0
+     */
+    inline int clz(uint32_t x)
+    {
+        if(x == 0)
+            return 32;
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanReverse(&i, x);
+        return 31 - int(i);
+#else
+        return __builtin_clz(x);
+#endif
+    }
+
+    /*
+     * spreads the 10 lower bits of x so that there are two zeros between each bit
+     */
+    inline uint32_t expand_bits(uint32_t x)
+    {
+        x &= 0x000003ffu;
+        x = (x | (x << 16)) & 0x030000ffu;
+        x = (x | (x <<  8)) & 0x0300f00fu;
+        x = (x | (x <<  4)) & 0x030c30c3u;
+        x = (x | (x <<  2)) & 0x09249249u;
+        return x;
+    }
+
+    /*
+     * 30 bits morton code of a point lying in [0,1]^3
+     */
+    template <typename Point>
+    uint32_t code(const Point & p)
+    {
+        uint32_t c = 0;
+        for(int d = 0; d < 3; d++)
+        {
+            float v = std::min(std::max(float(p[d]) * 1024.f, 0.f), 1023.f);
+            c |= expand_bits(uint32_t(v)) << (2 - d);
+        }
+        return c;
+    }
+
+    /*
+     * 30 bits morton code of a point, quantized inside 'bounds'
+     */
+    template <typename Scalar>
+    uint32_t code(const Eigen::Matrix<Scalar, 3, 1> & p, const Eigen::AlignedBox<Scalar, 3> & bounds)
+    {
+        Eigen::Matrix<Scalar, 3, 1> extents = bounds.sizes();
+        Eigen::Matrix<Scalar, 3, 1> normalized;
+        for(int d = 0; d < 3; d++)
+            normalized[d] = extents[d] > 0 ? (p[d] - bounds.min()[d]) / extents[d] : Scalar(0.5);
+        return code(normalized);
+    }
+
+    /*
+     * Parallel least significant digit radix sort of 'keys' (8 bits per pass), 'values' are permuted accordingly.
+     * Only the lower 'n_bits' bits of the keys are considered.
+     */
+    template <typename Value>
+    void radix_sort(std::vector<uint32_t> & keys, std::vector<Value> & values, unsigned n_bits = 32)
+    {
+        constexpr size_t RADIX = 256;
+        constexpr size_t BLOCK_SIZE = 1 << 14;
+        const size_t n = keys.size();
+
+        if(n < BLOCK_SIZE)
+        {
+            std::vector<size_t> order(n);
+            std::iota(order.begin(), order.end(), size_t(0));
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){return keys[a] < keys[b];});
+            std::vector<uint32_t> sorted_keys(n);
+            std::vector<Value> sorted_values(n);
+            for(size_t i = 0; i < n; i++)
+            {
+                sorted_keys[i] = keys[order[i]];
+                sorted_values[i] = values[order[i]];
+            }
+            keys.swap(sorted_keys);
+            values.swap(sorted_values);
+            return;
+        }
+
+        const size_t n_blocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        std::vector<uint32_t> keys_tmp(n);
+        std::vector<Value> values_tmp(n);
+        std::vector<size_t> histograms(n_blocks * RADIX);
+
+        for(unsigned shift = 0; shift < n_bits; shift += 8)
+        {
+            //per block histograms
+            tbb::parallel_for(size_t(0), n_blocks, [&](size_t b)
+            {
+                size_t * h = &histograms[b * RADIX];
+                std::fill(h, h + RADIX, size_t(0));
+                const size_t end = std::min(n, (b + 1) * BLOCK_SIZE);
+                for(size_t i = b * BLOCK_SIZE; i < end; i++)
+                    h[(keys[i] >> shift) & (RADIX - 1)]++;
+            });
+
+            //exclusive scan, digit major, so that each block scatters to its own slots and the sort stays stable
+            size_t offset = 0;
+            for(size_t digit = 0; digit < RADIX; digit++)
+                for(size_t b = 0; b < n_blocks; b++)
+                {
+                    size_t count = histograms[b * RADIX + digit];
+                    histograms[b * RADIX + digit] = offset;
+                    offset += count;
+                }
+
+            tbb::parallel_for(size_t(0), n_blocks, [&](size_t b)
+            {
+                size_t * h = &histograms[b * RADIX];
+                const size_t end = std::min(n, (b + 1) * BLOCK_SIZE);
+                for(size_t i = b * BLOCK_SIZE; i < end; i++)
+                {
+                    size_t & dst = h[(keys[i] >> shift) & (RADIX - 1)];
+                    keys_tmp[dst] = keys[i];
+                    values_tmp[dst] = values[i];
+                    dst++;
+                }
+            });
+
+            keys.swap(keys_tmp);
+            values.swap(values_tmp);
+        }
+    }
+}
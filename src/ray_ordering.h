@@ -0,0 +1,82 @@
+/*
+ * ray_ordering.h
+ *
+ *  Reorders batches of rays so that rays traced by the same task traverse the same parts of the tree
+ *
+ *      Author: Maxime Lemonnier
+ */
+
+#pragma once
+
+#include "morton.h"
+#include <Eigen/Dense>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <vector>
+
+namespace ordering
+{
+    /*
+     * number of consecutive (coherent) rays traced by the same task when rays are reordered
+     */
+    constexpr size_t COHERENT_GRAIN_SIZE = 64;
+
+    /*
+     * \return rays' indices sorted by direction octant first, then by origin's morton code
+     */
+    template <typename Points>
+    std::vector<size_t> coherent_order(const Points & origins, const Points & directions)
+    {
+        typedef typename Points::Scalar Scalar;
+        typedef Eigen::AlignedBox<Scalar, 3> Box;
+        const size_t n_rays = origins.rows();
+
+        Box bounds = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, n_rays), Box()
+        , [&](const tbb::blocked_range<size_t> & r, Box b)
+        {
+            for(size_t i = r.begin(); i < r.end(); i++)
+                b.extend(origins.row(i).transpose());
+            return b;
+        }
+        , [](const Box & a, const Box & b){return a.merged(b);});
+
+        std::vector<uint32_t> keys(n_rays);
+        std::vector<size_t> order(n_rays);
+        tbb::parallel_for(size_t(0), n_rays, [&](size_t i)
+        {
+            uint32_t octant = 0;
+            for(int d = 0; d < 3; d++)
+                octant |= (directions(i, d) < 0 ? 1u : 0u) << d;
+
+            keys[i] = (octant << 27) | (morton::code<Scalar>(origins.row(i).transpose(), bounds) >> 3);
+            order[i] = i;
+        });
+
+        morton::radix_sort(keys, order, 30);
+        return order;
+    }
+
+    /*
+     * calls f(i) for each ray i in parallel, in input order, or in coherent order if 'reorder' is true.
+     * Since f() receives the ray's input index, results are written back in input order.
+     */
+    template <typename Points, typename F>
+    void parallel_for_rays(const Points & origins, const Points & directions, bool reorder, F f)
+    {
+        const size_t n_rays = origins.rows();
+        if(!reorder)
+        {
+            tbb::parallel_for(size_t(0), n_rays, f);
+            return;
+        }
+
+        const std::vector<size_t> order = coherent_order(origins, directions);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, n_rays, COHERENT_GRAIN_SIZE), [&](const tbb::blocked_range<size_t> & r)
+        {
+            for(size_t k = r.begin(); k < r.end(); k++)
+                f(order[k]);
+        }
+        , tbb::simple_partitioner());
+    }
+}
@@ -0,0 +1,141 @@
+/*
+ * triangle_distances.h
+ *
+ *  Closest points between segments, points and triangles
+ *  (implementations inspired from Ericson, "Real-Time Collision Detection", 2005, chapter 5)
+ *
+ *      Author: Maxime Lemonnier
+ */
+
+#pragma once
+
+#include "traits.h"
+#include "triangle_intersections.h"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace distances
+{
+    /*
+     * Closest point of triangle (a, b, c) to point p
+     */
+    template <typename Point>
+    Point point_triangle_closest_point(const Point & p, const Point & a, const Point & b, const Point & c)
+    {
+        typedef scalar_t<Point> Scalar;
+
+        Point ab = b - a, ac = c - a, ap = p - a;
+        Scalar d1 = ab.dot(ap), d2 = ac.dot(ap);
+        if(d1 <= 0 && d2 <= 0)
+            return a;
+
+        Point bp = p - b;
+        Scalar d3 = ab.dot(bp), d4 = ac.dot(bp);
+        if(d3 >= 0 && d4 <= d3)
+            return b;
+
+        Scalar vc = d1 * d4 - d3 * d2;
+        if(vc <= 0 && d1 >= 0 && d3 <= 0)
+            return a + ab * (d1 / (d1 - d3));
+
+        Point cp = p - c;
+        Scalar d5 = ab.dot(cp), d6 = ac.dot(cp);
+        if(d6 >= 0 && d5 <= d6)
+            return c;
+
+        Scalar vb = d5 * d2 - d1 * d6;
+        if(vb <= 0 && d2 >= 0 && d6 <= 0)
+            return a + ac * (d2 / (d2 - d6));
+
+        Scalar va = d3 * d6 - d5 * d4;
+        if(va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        Scalar denom = 1 / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    template <typename Point>
+    scalar_t<Point> point_triangle_distance(const Point & p, const Point & a, const Point & b, const Point & c)
+    {
+        return (p - point_triangle_closest_point(p, a, b, c)).norm();
+    }
+
+    /*
+     * Minimum distance between segments [p0, p1] and [q0, q1]
+     */
+    template <typename Point>
+    scalar_t<Point> segment_segment_distance(const Point & p0, const Point & p1, const Point & q0, const Point & q1)
+    {
+        typedef scalar_t<Point> Scalar;
+        const Scalar epsilon = std::numeric_limits<Scalar>::epsilon();
+
+        Point d1 = p1 - p0, d2 = q1 - q0, r = p0 - q0;
+        Scalar a = d1.dot(d1), e = d2.dot(d2), f = d2.dot(r);
+        Scalar s, t;
+
+        if(a <= epsilon && e <= epsilon)
+            return r.norm();
+
+        if(a <= epsilon)
+        {
+            s = 0;
+            t = std::min(std::max(f / e, Scalar(0)), Scalar(1));
+        }
+        else
+        {
+            Scalar c = d1.dot(r);
+            if(e <= epsilon)
+            {
+                t = 0;
+                s = std::min(std::max(-c / a, Scalar(0)), Scalar(1));
+            }
+            else
+            {
+                Scalar b = d1.dot(d2);
+                Scalar denom = a * e - b * b;
+                s = denom != 0 ? std::min(std::max((b * f - c * e) / denom, Scalar(0)), Scalar(1)) : Scalar(0);
+                t = (b * s + f) / e;
+                if(t < 0)
+                {
+                    t = 0;
+                    s = std::min(std::max(-c / a, Scalar(0)), Scalar(1));
+                }
+                else if(t > 1)
+                {
+                    t = 1;
+                    s = std::min(std::max((b - c) / a, Scalar(0)), Scalar(1));
+                }
+            }
+        }
+        return ((p0 + d1 * s) - (q0 + d2 * t)).norm();
+    }
+
+    /*
+     * Minimum distance between triangles (v0, v1, v2) and (u0, u1, u2), 0 if they intersect
+     */
+    template <typename Point>
+    scalar_t<Point> triangle_triangle_distance(const Point & v0, const Point & v1, const Point & v2, const Point & u0, const Point & u1, const Point & u2)
+    {
+        typedef scalar_t<Point> Scalar;
+
+        if(intersections::intersect_triangle_triangle(v0, v1, v2, u0, u1, u2))
+            return Scalar(0);
+
+        //if they don't intersect, the minimum is reached on an edge-edge or a vertex-triangle pair
+        const Point * v[3] = {&v0, &v1, &v2};
+        const Point * u[3] = {&u0, &u1, &u2};
+        Scalar distance = std::numeric_limits<Scalar>::max();
+        for(int i = 0; i < 3; i++)
+        {
+            for(int j = 0; j < 3; j++)
+                distance = std::min(distance, segment_segment_distance(*v[i], *v[(i + 1) % 3], *u[j], *u[(j + 1) % 3]));
+
+            distance = std::min(distance, point_triangle_distance(*v[i], u0, u1, u2));
+            distance = std::min(distance, point_triangle_distance(*u[i], v0, v1, v2));
+        }
+        return distance;
+    }
+}
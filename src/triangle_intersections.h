@@ -0,0 +1,141 @@
+/*
+ * triangle_intersections.h
+ *
+ *      Author: Maxime Lemonnier
+ */
+#pragma once
+
+#include "traits.h"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace intersections
+{
+namespace detail
+{
+    template <typename Scalar>
+    void interval_from(Scalar vv0, Scalar vv1, Scalar vv2, Scalar d0, Scalar d1, Scalar d2, Scalar & i0, Scalar & i1)
+    {
+        i0 = vv0 + (vv1 - vv0) * d0 / (d0 - d1);
+        i1 = vv0 + (vv2 - vv0) * d0 / (d0 - d2);
+        if(i0 > i1)
+            std::swap(i0, i1);
+    }
+
+    /*
+     * interval of the line of intersection of both planes covered by a triangle,
+     * \return false if the triangle is coplanar with the other triangle's plane
+     */
+    template <typename Scalar>
+    bool triangle_interval(Scalar vv0, Scalar vv1, Scalar vv2, Scalar d0, Scalar d1, Scalar d2, Scalar & i0, Scalar & i1)
+    {
+        if(d0 * d1 > 0)
+            interval_from(vv2, vv0, vv1, d2, d0, d1, i0, i1);
+        else if(d0 * d2 > 0)
+            interval_from(vv1, vv0, vv2, d1, d0, d2, i0, i1);
+        else if(d1 * d2 > 0 || d0 != 0)
+            interval_from(vv0, vv1, vv2, d0, d1, d2, i0, i1);
+        else if(d1 != 0)
+            interval_from(vv1, vv0, vv2, d1, d0, d2, i0, i1);
+        else if(d2 != 0)
+            interval_from(vv2, vv0, vv1, d2, d0, d1, i0, i1);
+        else
+            return false;
+        return true;
+    }
+
+    template <typename Point2>
+    scalar_t<Point2> orient_2d(const Point2 & a, const Point2 & b, const Point2 & c)
+    {
+        return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+    }
+
+    template <typename Point2>
+    bool segments_2d(const Point2 & p0, const Point2 & p1, const Point2 & q0, const Point2 & q1)
+    {
+        auto d0 = orient_2d(p0, p1, q0), d1 = orient_2d(p0, p1, q1);
+        auto d2 = orient_2d(q0, q1, p0), d3 = orient_2d(q0, q1, p1);
+        if(((d0 > 0 && d1 < 0) || (d0 < 0 && d1 > 0)) && ((d2 > 0 && d3 < 0) || (d2 < 0 && d3 > 0)))
+            return true;
+        auto on_segment = [](const Point2 & a, const Point2 & b, const Point2 & p)
+        {
+            return std::min(a[0], b[0]) <= p[0] && p[0] <= std::max(a[0], b[0])
+                && std::min(a[1], b[1]) <= p[1] && p[1] <= std::max(a[1], b[1]);
+        };
+        return (d0 == 0 && on_segment(p0, p1, q0)) || (d1 == 0 && on_segment(p0, p1, q1))
+            || (d2 == 0 && on_segment(q0, q1, p0)) || (d3 == 0 && on_segment(q0, q1, p1));
+    }
+
+    template <typename Point2>
+    bool point_in_triangle_2d(const Point2 & p, const Point2 & a, const Point2 & b, const Point2 & c)
+    {
+        auto d0 = orient_2d(a, b, p), d1 = orient_2d(b, c, p), d2 = orient_2d(c, a, p);
+        return (d0 >= 0 && d1 >= 0 && d2 >= 0) || (d0 <= 0 && d1 <= 0 && d2 <= 0);
+    }
+
+    template <typename Point>
+    bool coplanar_triangles(const Point & n, const Point & v0, const Point & v1, const Point & v2, const Point & u0, const Point & u1, const Point & u2)
+    {
+        typedef Eigen::Matrix<scalar_t<Point>, 2, 1> Point2;
+
+        //project on the axis aligned plane that maximizes the triangles' area
+        int axis;
+        n.cwiseAbs().maxCoeff(&axis);
+        const int i0 = axis == 0 ? 1 : 0, i1 = axis == 2 ? 1 : 2;
+        auto project = [&](const Point & p){return Point2(p[i0], p[i1]);};
+        const Point2 v[3] = {project(v0), project(v1), project(v2)};
+        const Point2 u[3] = {project(u0), project(u1), project(u2)};
+
+        for(int i = 0; i < 3; i++)
+            for(int j = 0; j < 3; j++)
+                if(segments_2d(v[i], v[(i + 1) % 3], u[j], u[(j + 1) % 3]))
+                    return true;
+
+        return point_in_triangle_2d(v[0], u[0], u[1], u[2]) || point_in_triangle_2d(u[0], v[0], v[1], v[2]);
+    }
+}
+
+/*
+ * Möller's triangle-triangle intersection test
+ * "A Fast Triangle-Triangle Intersection Test", Journal of Graphics Tools, 2(2):25-30, 1997
+ */
+template <typename Point>
+bool intersect_triangle_triangle(const Point & v0, const Point & v1, const Point & v2, const Point & u0, const Point & u1, const Point & u2)
+{
+    typedef scalar_t<Point> Scalar;
+    const Scalar epsilon = std::numeric_limits<Scalar>::epsilon();
+
+    auto snap = [&](Scalar d, Scalar scale){return std::fabs(d) < epsilon * scale ? Scalar(0) : d;};
+
+    //signed distances of u's vertices to v's plane
+    Point n1 = (v1 - v0).cross(v2 - v0);
+    Scalar d1 = -n1.dot(v0);
+    Scalar scale1 = n1.cwiseAbs().sum() * (v0.cwiseAbs().maxCoeff() + u0.cwiseAbs().maxCoeff() + 1);
+    Scalar du0 = snap(n1.dot(u0) + d1, scale1), du1 = snap(n1.dot(u1) + d1, scale1), du2 = snap(n1.dot(u2) + d1, scale1);
+    if(du0 * du1 > 0 && du0 * du2 > 0)
+        return false;
+    if(du0 == 0 && du1 == 0 && du2 == 0)
+        return detail::coplanar_triangles(n1, v0, v1, v2, u0, u1, u2);
+
+    //signed distances of v's vertices to u's plane
+    Point n2 = (u1 - u0).cross(u2 - u0);
+    Scalar d2 = -n2.dot(u0);
+    Scalar scale2 = n2.cwiseAbs().sum() * (v0.cwiseAbs().maxCoeff() + u0.cwiseAbs().maxCoeff() + 1);
+    Scalar dv0 = snap(n2.dot(v0) + d2, scale2), dv1 = snap(n2.dot(v1) + d2, scale2), dv2 = snap(n2.dot(v2) + d2, scale2);
+    if(dv0 * dv1 > 0 && dv0 * dv2 > 0)
+        return false;
+
+    //project on the largest axis of the planes' intersection line
+    int axis;
+    n1.cross(n2).cwiseAbs().maxCoeff(&axis);
+
+    Scalar v_min, v_max, u_min, u_max;
+    if(!detail::triangle_interval(v0[axis], v1[axis], v2[axis], dv0, dv1, dv2, v_min, v_max))
+        return detail::coplanar_triangles(n1, v0, v1, v2, u0, u1, u2);
+    detail::triangle_interval(u0[axis], u1[axis], u2[axis], du0, du1, du2, u_min, u_max);
+
+    return !(v_max < u_min || u_max < v_min);
+}
+}